@@ -0,0 +1,174 @@
+from multiprocessing import cpu_count
+from subprocess import Popen
+import csv
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+# Number of times each benchmark is run; the fastest run is reported
+REPETITIONS = 3
+
+# Benchmarks named parallel_* are run with 1, 2, 4... harts, up to this many or the host's core count
+MAX_HARTS = 8
+
+# A benchmark is reported as a regression when its MIPS drops by more than this fraction
+REGRESSION_THRESHOLD = 0.10
+
+RESULTS_FILE = 'bench/results.csv'
+BASELINE_FILE = 'bench/baseline.csv'
+FIELDS = ['benchmark', 'instructions', 'seconds', 'mips', 'peak_rss_kb', 'exit_code']
+
+# Host counters printed for each benchmark with --perf; every per-instruction ratio goes into the results
+PERF_SUMMARY = ['cycles', 'host_instructions', 'branch_misses', 'cache_misses']
+
+if len(sys.argv) < 2:
+    sys.stderr.write('Usage: python3 bench/mips_benchmark.py <path-to-mips-simulator> [--update-baseline] [--perf]\n')
+    sys.exit(1)
+
+simulator = sys.argv[1]
+updateBaseline = '--update-baseline' in sys.argv[2:]
+perf = '--perf' in sys.argv[2:]
+
+# Reading counters around every MMIO access slows down I/O-heavy benchmarks
+if perf and updateBaseline:
+    sys.stderr.write('A baseline cannot be recorded with --perf\n')
+    sys.exit(1)
+
+# Compile benchmark sources into binaries
+os.system('mkdir -p bench/bin')
+for source in sorted(os.listdir('bench/src')):
+    benchmarkName = source[:-2]
+    os.system('make bench/bin/{}.mips.bin > /dev/null'.format(benchmarkName))
+
+
+def readKeyValues(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            key, value = line.strip().split('=')
+            values[key] = value
+    os.remove(path)
+    return values
+
+
+def run(binary, harts):
+    # Run the simulator once, returning (instructions, seconds, peak RSS in KB, exit code, host counters)
+    global perf
+    statsFile, statsPath = tempfile.mkstemp()
+    os.close(statsFile)
+    command = [simulator, binary, '--stats', statsPath]
+    if harts > 1:
+        command += ['--harts', str(harts)]
+    if perf:
+        perfFile, perfPath = tempfile.mkstemp()
+        os.close(perfFile)
+        command += ['--perf', perfPath]
+
+    with open(os.devnull, 'w') as devnull:
+        start = time.time()
+        p = Popen(command, stdout=devnull, stdin=devnull)
+        _, status, usage = os.wait4(p.pid, 0)
+        seconds = time.time() - start
+
+    instructions = int(readKeyValues(statsPath).get('instructions', 0))
+
+    # Only ratios to guest instructions are kept, since they compare across benchmarks
+    counters = {}
+    if perf:
+        report = readKeyValues(perfPath)
+        if report.get('available') == '0':
+            sys.stderr.write('Continuing without host counters\n')
+            perf = False
+        for key, value in report.items():
+            if key.endswith('_per_instruction'):
+                counters[key] = float(value)
+
+    # ru_maxrss is already in KB on Linux
+    return instructions, seconds, usage.ru_maxrss, os.WEXITSTATUS(status), counters
+
+
+def hartCounts(benchmarkName):
+    if not benchmarkName.startswith('parallel_'):
+        return [1]
+    counts = [1]
+    while counts[-1] * 2 <= min(MAX_HARTS, cpu_count()):
+        counts.append(counts[-1] * 2)
+    return counts
+
+
+results = []
+for binary in sorted(os.listdir('bench/bin')):
+    # Remove .mips.bin file ending
+    benchmarkName = binary[:-9]
+
+    singleHartSeconds = None
+    for harts in hartCounts(benchmarkName):
+        name = benchmarkName if harts == 1 else '{}@{}'.format(benchmarkName, harts)
+
+        best = None
+        for _ in range(REPETITIONS):
+            instructions, seconds, peakRss, exitCode, counters = run('bench/bin/' + binary, harts)
+            if best is None or seconds < best['seconds']:
+                best = {'benchmark': name, 'instructions': instructions, 'seconds': seconds,
+                        'peak_rss_kb': peakRss, 'exit_code': exitCode}
+                best.update(counters)
+
+        best['mips'] = best['instructions'] / best['seconds'] / 1e6
+        scaling = ''
+        if harts == 1:
+            singleHartSeconds = best['seconds']
+        else:
+            scaling = ', {:.2f}x speedup over 1 hart'.format(singleHartSeconds / best['seconds'])
+        hostCounters = ''.join(', {:.2f} {} per instruction'.format(best[event + '_per_instruction'],
+                                                                       event.replace('_', ' '))
+                               for event in PERF_SUMMARY if event + '_per_instruction' in best)
+        print('{}, {} instructions, {:.3f}s, {:.2f} MIPS, {} KB peak RSS{}{}'.format(
+            name, best['instructions'], best['seconds'], best['mips'], best['peak_rss_kb'], scaling, hostCounters))
+        results.append(best)
+
+with open(RESULTS_FILE, 'w') as f:
+    perfFields = sorted(set(key for result in results for key in result if key.endswith('_per_instruction')))
+    writer = csv.DictWriter(f, fieldnames=FIELDS + perfFields)
+    writer.writeheader()
+    for result in results:
+        writer.writerow(result)
+
+if updateBaseline:
+    shutil.copyfile(RESULTS_FILE, BASELINE_FILE)
+    sys.stderr.write('Baseline updated in {}\n'.format(BASELINE_FILE))
+    sys.exit(0)
+
+if not os.path.isfile(BASELINE_FILE):
+    sys.stderr.write('No baseline found; run with --update-baseline to record one\n')
+    sys.exit(0)
+
+with open(BASELINE_FILE) as f:
+    baseline = dict((row['benchmark'], row) for row in csv.DictReader(f))
+
+regressions = 0
+for result in results:
+    expected = baseline.get(result['benchmark'])
+    if expected is None:
+        continue
+
+    # The startup benchmark retires a single instruction, so compare its run time instead
+    if int(expected['instructions']) <= 1:
+        slowdown = result['seconds'] / float(expected['seconds']) - 1
+    else:
+        slowdown = 1 - result['mips'] / float(expected['mips'])
+
+    # Harts spinning on each other retire a varying number of instructions, so only single-hart counts must match
+    countChanged = '@' not in result['benchmark'] and int(expected['instructions']) != result['instructions']
+    if countChanged or int(expected['exit_code']) != result['exit_code']:
+        sys.stderr.write('MISMATCH IN {}: instruction count or exit code differs from the baseline\n'.format(
+            result['benchmark']))
+        regressions += 1
+    elif slowdown > REGRESSION_THRESHOLD:
+        sys.stderr.write('REGRESSION IN {}: {:.1f}% slower than the baseline\n'.format(
+            result['benchmark'], 100 * slowdown))
+        regressions += 1
+
+sys.stderr.write('Benchmarks regressed: {}/{}\n'.format(regressions, len(results)))
+sys.exit(1 if regressions else 0)
@@ -0,0 +1,33 @@
+# Benchmark
+# Multiply, divide and trapping add/sub in a tight loop, reading hi/lo after each
+    .globl entry
+    .set noreorder
+
+entry:
+    li $t0, 4000000     # Iterations remaining
+    li $t1, 40503       # Multiplier and divisor
+    li $t2, 0           # Checksum
+
+loop:
+    mult $t0, $t1
+    mflo $t3
+    andi $t3, $t3, 0xFFFF
+    add $t4, $t3, $t0
+    sub $t4, $t4, $t1
+    multu $t4, $t4
+    mfhi $t5
+    xor $t2, $t2, $t5
+    div $t4, $t1
+    mfhi $t5
+    mflo $t6
+    xor $t2, $t2, $t5
+    divu $t4, $t1
+    mflo $t6
+    xor $t2, $t2, $t6
+    addi $t0, $t0, -1
+    bne $t0, $zero, loop
+    nop
+
+    andi $v0, $t2, 0xFF
+    jr $zero
+    nop
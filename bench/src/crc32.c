@@ -0,0 +1,35 @@
+// Benchmark
+// Bitwise CRC-32 over a 64KB pseudo-random buffer, repeated 4 times
+
+asm("li $29, 0x24000000");
+
+unsigned int crc32(unsigned char *buffer, int size, unsigned int crc);
+
+int entry() {
+    unsigned char *buffer = (unsigned char *) 0x20000000;
+    int size = 65536;
+    unsigned int seed = 1;
+
+    for (int i = 0; i < size; i++) {
+        seed = seed * 1664525 + 1013904223;
+        buffer[i] = (unsigned char) (seed >> 24);
+    }
+
+    unsigned int crc = 0;
+    for (int pass = 0; pass < 4; pass++) {
+        crc = crc32(buffer, size, crc);
+    }
+    return (int) (crc & 0xFF);
+}
+
+unsigned int crc32(unsigned char *buffer, int size, unsigned int crc) {
+    crc = ~crc;
+    for (int i = 0; i < size; i++) {
+        crc ^= buffer[i];
+        for (int bit = 0; bit < 8; bit++) {
+            unsigned int mask = -(crc & 1);
+            crc = (crc >> 1) ^ (0xEDB88320 & mask);
+        }
+    }
+    return ~crc;
+}
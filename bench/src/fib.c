@@ -0,0 +1,17 @@
+// Benchmark
+// Naive recursive Fibonacci, dominated by call and return overhead
+
+asm("li $29, 0x24000000");
+
+int fib(int n);
+
+int entry() {
+    return fib(27) & 0xFF;
+}
+
+int fib(int n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
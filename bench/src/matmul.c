@@ -0,0 +1,33 @@
+// Benchmark
+// Multiply two 96x96 integer matrices
+
+asm("li $29, 0x24000000");
+
+#define N 96
+
+int entry() {
+    int *a = (int *) 0x20000000;
+    int *b = a + N * N;
+    int *c = b + N * N;
+
+    for (int i = 0; i < N * N; i++) {
+        a[i] = i % 13 - 6;
+        b[i] = i % 7 - 3;
+    }
+
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            int sum = 0;
+            for (int k = 0; k < N; k++) {
+                sum += a[i * N + k] * b[k * N + j];
+            }
+            c[i * N + j] = sum;
+        }
+    }
+
+    int checksum = 0;
+    for (int i = 0; i < N * N; i++) {
+        checksum ^= c[i];
+    }
+    return checksum & 0xFF;
+}
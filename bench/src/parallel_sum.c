@@ -0,0 +1,54 @@
+// Benchmark
+// Each hart sums the squares of its share of 2M words, combining the partial sums with atomic MMIO
+
+// Give each hart its own 64KB stack below 0x24000000
+asm("lui $8, 0x3000\n"
+    "lw $8, 8($8)\n"
+    "sll $8, $8, 16\n"
+    "lui $29, 0x2400\n"
+    "subu $29, $29, $8");
+
+#define MMIO(address) (*(volatile unsigned int *) (address))
+#define HART_ID MMIO(0x30000008)
+#define HART_COUNT MMIO(0x3000000C)
+#define AMO_ADDRESS MMIO(0x30000010)
+#define AMO_OPERAND MMIO(0x30000014)
+#define AMO_ADD MMIO(0x3000001C)
+
+unsigned int atomicAdd(volatile unsigned int *address, unsigned int value);
+
+int entry() {
+    unsigned int hart = HART_ID;
+    unsigned int harts = HART_COUNT;
+    volatile unsigned int *total = (unsigned int *) 0x20000000;
+    volatile unsigned int *finished = total + 1;
+    unsigned int *values = (unsigned int *) 0x20001000;
+    unsigned int size = 1 << 21;
+
+    // Contiguous shares, so harts do not write to the same host cache lines
+    unsigned int begin = size / harts * hart;
+    unsigned int end = hart == harts - 1 ? size : begin + size / harts;
+
+    unsigned int sum = 0;
+    for (unsigned int i = begin; i < end; i++) {
+        values[i] = i * 7 + 3;
+        sum += values[i] * values[i];
+    }
+
+    atomicAdd(total, sum);
+    atomicAdd(finished, 1);
+
+    // Only hart 0 waits for the others and ends the program
+    if (hart != 0) {
+        return 0;
+    }
+    while (*finished != harts) {
+    }
+    return (int) (*total & 0xFF);
+}
+
+unsigned int atomicAdd(volatile unsigned int *address, unsigned int value) {
+    AMO_ADDRESS = (unsigned int) address;
+    AMO_OPERAND = value;
+    return AMO_ADD;
+}
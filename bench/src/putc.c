@@ -0,0 +1,16 @@
+// Benchmark
+// Write 1MB of text to stdout through ADDR_PUTC
+
+asm("li $29, 0x24000000");
+
+int entry() {
+    volatile int *output = (int *) 0x30000004;
+
+    for (int line = 0; line < 16384; line++) {
+        for (int i = 0; i < 63; i++) {
+            *output = 'a' + (line + i) % 26;
+        }
+        *output = '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Benchmark
+// Quicksort 16384 pseudo-random words, then check the result is ordered
+
+asm("li $29, 0x24000000");
+
+void quicksort(int *values, int low, int high);
+
+int entry() {
+    int *values = (int *) 0x20000000;
+    int size = 16384;
+    unsigned int seed = 12345;
+
+    for (int i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        values[i] = (int) (seed >> 8);
+    }
+
+    quicksort(values, 0, size - 1);
+
+    for (int i = 1; i < size; i++) {
+        if (values[i - 1] > values[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void quicksort(int *values, int low, int high) {
+    while (low < high) {
+        int pivot = values[(low + high) / 2];
+        int i = low;
+        int j = high;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                int temp = values[i];
+                values[i] = values[j];
+                values[j] = temp;
+                i++;
+                j--;
+            }
+        }
+        // Recurse into the smaller half to bound the stack depth
+        if (j - low < high - i) {
+            quicksort(values, low, j);
+            low = i;
+        } else {
+            quicksort(values, i, high);
+            high = j;
+        }
+    }
+}
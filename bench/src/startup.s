@@ -0,0 +1,6 @@
+# Benchmark
+# Exit immediately, so the run time is the simulator's startup and teardown
+    .globl entry
+
+entry:
+    jr $zero
@@ -0,0 +1,65 @@
+#include <fstream>
+#include <iostream>
+#include "Coverage.h"
+
+using namespace std;
+
+Coverage::Coverage(uint32_t memoryWords, uint32_t programWords) :
+        executed((memoryWords + 7) / 8),
+        taken((memoryWords + 7) / 8),
+        notTaken((memoryWords + 7) / 8),
+        programWords(programWords) {}
+
+void Coverage::setBit(vector<uint8_t> &bitmap, uint32_t index) {
+    bitmap[index / 8] |= static_cast<uint8_t>(1 << (index % 8));
+}
+
+void Coverage::recordInstruction(uint32_t index, Instruction *instruction) {
+    setBit(executed, index);
+
+    InstructionOpcode opcode = instruction->getOpcode();
+    opcodes |= 1ULL << opcode;
+    if (opcode == R) {
+        functionCodes |= 1ULL << instruction->getFunctionCode();
+    } else if (opcode == B_SPEC) {
+        bCodes |= 1U << instruction->getBCode();
+    }
+}
+
+void Coverage::recordBranch(uint32_t index, bool branchTaken) {
+    setBit(branchTaken ? taken : notTaken, index);
+}
+
+static void writeLittleEndian(ofstream &file, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        file.put(static_cast<char>((value >> (8 * i)) & MASK_BYTE));
+    }
+}
+
+void Coverage::writeToFile(const char *path, uint64_t programHash) {
+    // Only write bitmaps up to the end of the program, or the last word executed beyond it
+    uint32_t words = programWords;
+    for (uint32_t i = static_cast<uint32_t>(executed.size()); i > (words + 7) / 8; i--) {
+        if (executed[i - 1] != 0) {
+            words = i * 8;
+            break;
+        }
+    }
+    uint32_t bitmapBytes = (words + 7) / 8;
+
+    ofstream file(path, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Unable to write coverage to " << path << endl;
+        return;
+    }
+
+    file.write(COVERAGE_MAGIC, 8);
+    writeLittleEndian(file, programHash, 8);
+    writeLittleEndian(file, words, 4);
+    writeLittleEndian(file, opcodes, 8);
+    writeLittleEndian(file, functionCodes, 8);
+    writeLittleEndian(file, bCodes, 4);
+    file.write(reinterpret_cast<const char *>(executed.data()), bitmapBytes);
+    file.write(reinterpret_cast<const char *>(taken.data()), bitmapBytes);
+    file.write(reinterpret_cast<const char *>(notTaken.data()), bitmapBytes);
+}
@@ -0,0 +1,37 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <cstdint>
+#include <vector>
+#include "Instruction.h"
+
+#define COVERAGE_MAGIC "MIPSCOV1"
+
+// Records which instruction words executed, which directions each conditional branch took, and
+// which opcodes, function codes and REGIMM codes were hit. Each is kept as a bitmap so that runs
+// can be merged by OR-ing their reports together (see test/mips_coverage.py).
+class Coverage {
+private:
+    std::vector<uint8_t> executed;
+    std::vector<uint8_t> taken;
+    std::vector<uint8_t> notTaken;
+    uint64_t opcodes = 0;
+    uint64_t functionCodes = 0;
+    uint32_t bCodes = 0;
+
+    // Number of words in the loaded program image
+    uint32_t programWords;
+
+    static void setBit(std::vector<uint8_t> &bitmap, uint32_t index);
+
+public:
+    Coverage(uint32_t memoryWords, uint32_t programWords);
+
+    // Word index is relative to ADDR_INSTR
+    void recordInstruction(uint32_t index, Instruction *instruction);
+    void recordBranch(uint32_t index, bool branchTaken);
+
+    void writeToFile(const char *path, uint64_t programHash);
+};
+
+#endif
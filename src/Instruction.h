@@ -21,6 +21,10 @@
 #define SHIFT_RED_D 11
 #define SHIFT_SHIFT_AMOUNT 6
 
+// Number of distinct opcodes and function codes (6 bits each)
+#define OPCODE_TABLE_SIZE 64
+#define FUNCTION_CODE_TABLE_SIZE 64
+
 enum RTypeFunctionCode {
     SLL     = 0b000000,
     SRL     = 0b000010,
@@ -93,18 +97,50 @@ class Instruction {
 private:
     uint32_t instruction;
 public:
-    explicit Instruction(uint32_t instruction) : instruction(instruction) {};
-    InstructionOpcode getOpcode();
-    uint8_t getRegisterS();
-    uint8_t getRegisterT();
-    uint8_t getRegisterD();
-    uint8_t getShiftAmount();
-    RTypeFunctionCode getFunctionCode();
-    BTypeCode getBCode();
-    uint16_t getImmediateOperand();
-    uint32_t getJumpAddress();
-    void printRaw();
-    uint32_t getRaw();
+    constexpr explicit Instruction(uint32_t instruction) : instruction(instruction) {};
+
+    // Field extraction is header-only and constexpr so that every handler can inline it
+    constexpr InstructionOpcode getOpcode() const {
+        return static_cast<InstructionOpcode>(instruction >> SHIFT_OPCODE);
+    }
+
+    constexpr uint8_t getRegisterS() const {
+        return static_cast<uint8_t>((instruction >> SHIFT_REG_S) & MASK_REG);
+    }
+
+    constexpr uint8_t getRegisterT() const {
+        return static_cast<uint8_t>((instruction >> SHIFT_REG_T) & MASK_REG);
+    }
+
+    constexpr uint8_t getRegisterD() const {
+        return static_cast<uint8_t>((instruction >> SHIFT_RED_D) & MASK_REG);
+    }
+
+    constexpr uint8_t getShiftAmount() const {
+        return static_cast<uint8_t>((instruction >> SHIFT_SHIFT_AMOUNT) & MASK_REG);
+    }
+
+    constexpr RTypeFunctionCode getFunctionCode() const {
+        return static_cast<RTypeFunctionCode>(instruction & MASK_FUNCTION_CODE);
+    }
+
+    constexpr BTypeCode getBCode() const {
+        return static_cast<BTypeCode>(getRegisterT());
+    }
+
+    constexpr uint16_t getImmediateOperand() const {
+        return static_cast<uint16_t>(instruction & MASK_IMMEDIATE_OPERAND);
+    }
+
+    constexpr uint32_t getJumpAddress() const {
+        return instruction & MASK_JUMP_ADDRESS;
+    }
+
+    constexpr uint32_t getRaw() const {
+        return instruction;
+    }
+
+    void printRaw() const;
 };
 
 #endif
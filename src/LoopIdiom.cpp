@@ -0,0 +1,171 @@
+#include "LoopIdiom.h"
+#include "System.h"
+
+using namespace std;
+
+static int32_t signedImmediate(Instruction instruction) {
+    return static_cast<int16_t>(instruction.getImmediateOperand());
+}
+
+// Symbolically executes one iteration, tracking every register as a LoopValue
+class LoopAnalysis {
+private:
+    LoopIdiom &idiom;
+    LoopValue values[REGISTERS_SIZE];
+
+    void write(uint8_t reg, LoopValue value) {
+        if (reg != 0) {
+            values[reg] = value;
+        }
+    }
+
+    bool access(Instruction instruction, LoopAccess *access, uint8_t width, bool signExtend) {
+        LoopValue base = values[instruction.getRegisterS()];
+        if (base.loaded) {
+            return false;
+        }
+        *access = {width, signExtend, {false, base.base, base.offset + signedImmediate(instruction)}};
+        return true;
+    }
+
+public:
+    explicit LoopAnalysis(LoopIdiom &idiom) : idiom(idiom) {
+        for (uint8_t reg = 0; reg < REGISTERS_SIZE; reg++) {
+            values[reg] = {false, reg, 0};
+        }
+    }
+
+    bool step(Instruction instruction) {
+        switch (instruction.getOpcode()) {
+            case ADDIU: {
+                LoopValue source = values[instruction.getRegisterS()];
+                if (source.loaded) {
+                    return instruction.getRegisterT() == 0;
+                }
+                write(instruction.getRegisterT(), {false, source.base, source.offset + signedImmediate(instruction)});
+                return true;
+            }
+            case R:
+                if (instruction.getRaw() == 0) {
+                    return true;
+                }
+                // move, as addu or or with $zero
+                if ((instruction.getFunctionCode() == ADDU || instruction.getFunctionCode() == OR) &&
+                    instruction.getRegisterT() == 0) {
+                    write(instruction.getRegisterD(), values[instruction.getRegisterS()]);
+                    return true;
+                }
+                return false;
+            case LB:
+            case LBU:
+            case LW:
+                if (idiom.hasLoad || idiom.hasStore) {
+                    return false;
+                }
+                idiom.hasLoad = true;
+                if (!access(instruction, &idiom.load, instruction.getOpcode() == LW ? WORD_SIZE_IN_BYTES : 1,
+                            instruction.getOpcode() == LB)) {
+                    return false;
+                }
+                write(instruction.getRegisterT(), {true, 0, 0});
+                return true;
+            case SB:
+            case SW:
+                if (idiom.hasStore) {
+                    return false;
+                }
+                idiom.hasStore = true;
+                idiom.storeValue = values[instruction.getRegisterT()];
+                return access(instruction, &idiom.store, instruction.getOpcode() == SW ? WORD_SIZE_IN_BYTES : 1, false);
+            default:
+                return false;
+        }
+    }
+
+    void branch(Instruction instruction) {
+        idiom.conditionLeft = values[instruction.getRegisterS()];
+        idiom.conditionRight = values[instruction.getRegisterT()];
+    }
+
+    // Every value used must be relative to a register that changes by a constant each iteration
+    bool isInduction(const LoopValue &value) const {
+        return value.loaded || (!values[value.base].loaded && values[value.base].base == value.base);
+    }
+
+    bool finish() {
+        for (uint8_t reg = 0; reg < REGISTERS_SIZE; reg++) {
+            idiom.results[reg] = values[reg];
+            idiom.steps[reg] = values[reg].loaded ? 0 : values[reg].offset;
+            if (!isInduction(values[reg])) {
+                return false;
+            }
+        }
+
+        LoopValue &left = idiom.conditionLeft;
+        LoopValue &right = idiom.conditionRight;
+        if (!isInduction(left) || !isInduction(right) || (left.loaded && right.loaded)) {
+            return false;
+        }
+        if (left.loaded || right.loaded) {
+            // Scan for a terminating byte: the loop must read consecutive bytes and compare with an invariant
+            const LoopValue &needle = left.loaded ? right : left;
+            if (idiom.load.width != 1 || idiom.steps[idiom.load.address.base] != 1 || idiom.steps[needle.base] != 0) {
+                return false;
+            }
+        } else {
+            // Solvable for the trip count when the two sides close in by a power of two per iteration
+            int32_t closing = idiom.steps[left.base] - idiom.steps[right.base];
+            uint32_t magnitude = closing < 0 ? -static_cast<uint32_t>(closing) : static_cast<uint32_t>(closing);
+            if (magnitude == 0 || (magnitude & (magnitude - 1)) != 0) {
+                return false;
+            }
+        }
+
+        if (idiom.hasLoad && (!isInduction(idiom.load.address) ||
+                              idiom.steps[idiom.load.address.base] != idiom.load.width)) {
+            return false;
+        }
+        if (idiom.hasStore) {
+            if (!isInduction(idiom.store.address) || idiom.steps[idiom.store.address.base] != idiom.store.width) {
+                return false;
+            }
+            // The stored value is either what was loaded, at the same width, or the same every iteration
+            if (idiom.storeValue.loaded) {
+                if (idiom.load.width != idiom.store.width) {
+                    return false;
+                }
+            } else if (!isInduction(idiom.storeValue) || idiom.steps[idiom.storeValue.base] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+unique_ptr<const LoopIdiom> LoopIdiom::analyse(const vector<Instruction> &instructions, uint32_t branchIndex) {
+    Instruction branch = instructions[branchIndex];
+    int32_t offset = signedImmediate(branch);
+    if (branch.getOpcode() != BNE || offset >= 0 || 1 - offset > LOOP_IDIOM_MAX_LENGTH ||
+        static_cast<int32_t>(branchIndex) + 1 + offset < 0 || branchIndex + 1 >= instructions.size()) {
+        return nullptr;
+    }
+
+    // The branch is relative to its delay slot
+    uint32_t entryIndex = branchIndex + 1 + offset;
+    auto idiom = unique_ptr<LoopIdiom>(new LoopIdiom());
+    idiom->entry = ADDR_INSTR + entryIndex * WORD_SIZE_IN_BYTES;
+    idiom->exit = ADDR_INSTR + (branchIndex + 2) * WORD_SIZE_IN_BYTES;
+    idiom->length = branchIndex + 2 - entryIndex;
+
+    LoopAnalysis analysis(*idiom);
+    for (uint32_t index = entryIndex; index < branchIndex; index++) {
+        if (!analysis.step(instructions[index])) {
+            return nullptr;
+        }
+    }
+    analysis.branch(branch);
+    if (!analysis.step(instructions[branchIndex + 1]) || !analysis.finish()) {
+        return nullptr;
+    }
+    return idiom;
+}
@@ -0,0 +1,57 @@
+#ifndef LOOP_IDIOM_H
+#define LOOP_IDIOM_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Instruction.h"
+
+// Longest loop body, including the branch and its delay slot, that is analysed
+#define LOOP_IDIOM_MAX_LENGTH 8
+
+// A register value relative to the start of an iteration: the value of register base plus offset,
+// or whatever the loop's load read in that iteration
+struct LoopValue {
+    bool loaded;
+    uint8_t base;
+    int32_t offset;
+};
+
+struct LoopAccess {
+    // Byte or word; the address is a LoopValue whose base steps by exactly the width each iteration
+    uint8_t width;
+    bool signExtend;
+    LoopValue address;
+};
+
+// A short loop that only moves pointers and counters by constants and does at most one byte or word
+// load and one store: the compiled form of memcpy, memset, strlen and strcpy loops, and of plain
+// counting loops. Running k iterations of it can be done at once with host memory operations,
+// because every register after k iterations is a closed-form function of the registers before.
+struct LoopIdiom {
+    uint32_t entry;
+    uint32_t exit;
+    uint32_t length;
+
+    // How much each register grows per iteration; only meaningful for registers that are inductions
+    int32_t steps[32];
+
+    // Each register's value at the end of an iteration, relative to the start of that iteration
+    LoopValue results[32];
+
+    bool hasLoad = false;
+    bool hasStore = false;
+    LoopAccess load;
+    LoopAccess store;
+    LoopValue storeValue;
+
+    // The loop continues while these two values, taken when the branch executes, differ
+    LoopValue conditionLeft;
+    LoopValue conditionRight;
+
+    // Analyse the loop closed by the branch at the given word index, returning nullptr if it is not one
+    static std::unique_ptr<const LoopIdiom> analyse(const std::vector<Instruction> &instructions,
+                                                    uint32_t branchIndex);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#include "Metrics.h"
+
+using namespace std;
+
+MetricsWriter::MetricsWriter(const char *path, vector<HartMetrics *> harts, uint64_t intervalMs) :
+        path(path),
+        harts(move(harts)),
+        interval(intervalMs),
+        startTime(chrono::steady_clock::now()),
+        lastTime(startTime) {}
+
+void MetricsWriter::start() {
+    thread(&MetricsWriter::run, this).detach();
+}
+
+void MetricsWriter::run() {
+    for (;;) {
+        this_thread::sleep_for(interval);
+        lock_guard<mutex> lock(writeMutex);
+        if (finished) {
+            return;
+        }
+        write();
+    }
+}
+
+void MetricsWriter::finish() {
+    lock_guard<mutex> lock(writeMutex);
+    write();
+    finished = true;
+}
+
+static void writeMetric(ofstream &file, const char *name, const char *type, const char *help) {
+    file << "# HELP " << name << " " << help << "\n";
+    file << "# TYPE " << name << " " << type << "\n";
+}
+
+// One sample per hart of a counter from HartMetrics
+template<typename T>
+static void writePerHart(ofstream &file, const vector<HartMetrics *> &harts, const char *name,
+                         atomic<T> HartMetrics::*counter) {
+    for (size_t hart = 0; hart < harts.size(); hart++) {
+        file << name << "{hart=\"" << hart << "\"} " << (harts[hart]->*counter).load(memory_order_relaxed) << "\n";
+    }
+}
+
+void MetricsWriter::write() {
+    auto now = chrono::steady_clock::now();
+    uint64_t instructions = 0;
+    for (HartMetrics *hart : harts) {
+        instructions += hart->instructions.load(memory_order_relaxed);
+    }
+    double elapsed = chrono::duration<double>(now - lastTime).count();
+    double rate = elapsed > 0 ? (instructions - lastInstructions) / elapsed : 0;
+    lastInstructions = instructions;
+    lastTime = now;
+
+    // Written beside the target and renamed over it, so a reader never sees a partial file
+    string temporaryPath = path + ".tmp." + to_string(getpid());
+    {
+        ofstream file(temporaryPath);
+        writeMetric(file, "mips_uptime_seconds", "gauge", "Seconds since the simulator started.");
+        file << "mips_uptime_seconds " << chrono::duration<double>(now - startTime).count() << "\n";
+        writeMetric(file, "mips_instructions_per_second", "gauge",
+                    "Guest instructions retired per second since the previous write, over all harts.");
+        file << "mips_instructions_per_second " << rate << "\n";
+        writeMetric(file, "mips_instructions_retired_total", "counter", "Guest instructions retired.");
+        writePerHart(file, harts, "mips_instructions_retired_total", &HartMetrics::instructions);
+        writeMetric(file, "mips_pc", "gauge", "Guest program counter when the counters were last published.");
+        writePerHart(file, harts, "mips_pc", &HartMetrics::pc);
+        writeMetric(file, "mips_mmio_bytes_in_total", "counter", "Bytes read from stdin through MMIO.");
+        writePerHart(file, harts, "mips_mmio_bytes_in_total", &HartMetrics::mmioBytesIn);
+        writeMetric(file, "mips_mmio_bytes_out_total", "counter", "Bytes written to stdout through MMIO.");
+        writePerHart(file, harts, "mips_mmio_bytes_out_total", &HartMetrics::mmioBytesOut);
+        writeMetric(file, "mips_touched_data_pages", "gauge", "4 KiB data memory pages written so far.");
+        writePerHart(file, harts, "mips_touched_data_pages", &HartMetrics::touchedPages);
+        writeMetric(file, "mips_traces_formed_total", "counter", "Traces formed from branch profiles.");
+        writePerHart(file, harts, "mips_traces_formed_total", &HartMetrics::tracesFormed);
+        writeMetric(file, "mips_traces_invalidated_total", "counter", "Traces dropped after too many side exits.");
+        writePerHart(file, harts, "mips_traces_invalidated_total", &HartMetrics::tracesInvalidated);
+        writeMetric(file, "mips_traces_loaded_total", "counter", "Traces formed from the on-disk cache.");
+        writePerHart(file, harts, "mips_traces_loaded_total", &HartMetrics::tracesLoaded);
+        writeMetric(file, "mips_loop_idioms_run_total", "counter", "Copy, fill and scan loops run as host memory operations.");
+        writePerHart(file, harts, "mips_loop_idioms_run_total", &HartMetrics::loopIdiomsRun);
+        file.close();
+        if (!file) {
+            unlink(temporaryPath.c_str());
+            return;
+        }
+    }
+    rename(temporaryPath.c_str(), path.c_str());
+}
@@ -0,0 +1,59 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Instructions between a System publishing its counters
+#define METRICS_PUBLISH_INTERVAL (1 << 20)
+
+#define DEFAULT_METRICS_INTERVAL_MS 1000
+
+// Counters a System publishes from its own thread, every METRICS_PUBLISH_INTERVAL instructions, for
+// the metrics writer to read from another. Only relaxed atomics are used: each counter is read whole,
+// but the set is not a consistent snapshot.
+struct HartMetrics {
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint32_t> pc{0};
+    std::atomic<uint64_t> mmioBytesIn{0};
+    std::atomic<uint64_t> mmioBytesOut{0};
+    std::atomic<uint64_t> touchedPages{0};
+    std::atomic<uint64_t> tracesFormed{0};
+    std::atomic<uint64_t> tracesInvalidated{0};
+    std::atomic<uint64_t> tracesLoaded{0};
+    std::atomic<uint64_t> loopIdiomsRun{0};
+};
+
+// Periodically writes the harts' published counters to a file in the Prometheus text format, for a
+// node exporter's textfile collector or anything else that polls it
+class MetricsWriter {
+private:
+    std::string path;
+    std::vector<HartMetrics *> harts;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point startTime;
+
+    // Serialises writes between the writer thread and the final write at exit
+    std::mutex writeMutex;
+    bool finished = false;
+    uint64_t lastInstructions = 0;
+    std::chrono::steady_clock::time_point lastTime;
+
+    void run();
+    void write();
+
+public:
+    MetricsWriter(const char *path, std::vector<HartMetrics *> harts, uint64_t intervalMs);
+
+    // Start writing on a detached thread
+    void start();
+
+    // Write once more and stop; called at exit, after hart 0 has published its final counters
+    void finish();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "PerfCounters.h"
+
+using namespace std;
+
+static const uint64_t EVENT_CONFIGS[PERF_EVENT_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,
+};
+static const char *EVENT_NAMES[PERF_EVENT_COUNT] = {"cycles", "host_instructions", "branch_misses", "cache_misses"};
+static const char *PHASE_NAMES[PERF_PHASE_COUNT] = {"load", "execute", "mmio"};
+
+PerfCounters::PerfCounters() {
+    // The first counter that opens leads the group, so all of them are read with one syscall
+    int leader = -1;
+    for (int event = 0; event < PERF_EVENT_COUNT; event++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = EVENT_CONFIGS[event];
+        attr.disabled = leader == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        fds[event] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+        groupIndex[event] = -1;
+        if (fds[event] == -1) {
+            if (unavailableErrno == 0) {
+                unavailableErrno = errno;
+            }
+            continue;
+        }
+        if (leader == -1) {
+            leader = fds[event];
+        }
+        groupIndex[event] = openCount++;
+    }
+
+    if (leader != -1) {
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        read(last);
+    }
+}
+
+bool PerfCounters::isAvailable() const {
+    return openCount > 0;
+}
+
+void PerfCounters::read(uint64_t *values) {
+    // A group read returns the number of counters followed by their values, in the order they were opened.
+    // If it fails, values keeps what it held, so nothing is attributed to the phase.
+    uint64_t buffer[1 + PERF_EVENT_COUNT] = {};
+    for (int event = 0; event < PERF_EVENT_COUNT; event++) {
+        if (groupIndex[event] == 0) {
+            if (::read(fds[event], buffer, sizeof(buffer)) < 0) {
+                return;
+            }
+        }
+    }
+    for (int event = 0; event < PERF_EVENT_COUNT; event++) {
+        values[event] = groupIndex[event] == -1 ? 0 : buffer[1 + groupIndex[event]];
+    }
+}
+
+void PerfCounters::enter(PerfPhase phase) {
+    if (!isAvailable()) {
+        return;
+    }
+    uint64_t now[PERF_EVENT_COUNT];
+    copy(last, last + PERF_EVENT_COUNT, now);
+    read(now);
+    for (int event = 0; event < PERF_EVENT_COUNT; event++) {
+        totals[this->phase][event] += now[event] - last[event];
+        last[event] = now[event];
+    }
+    this->phase = phase;
+}
+
+void PerfCounters::writeReport(const char *path, uint64_t guestInstructions) {
+    ofstream report(path);
+    if (!isAvailable()) {
+        cerr << "Host performance counters are unavailable: " << strerror(unavailableErrno) << endl;
+        report << "available=0" << endl;
+        return;
+    }
+    enter(phase);
+
+    report << "available=1" << endl;
+    report << "instructions=" << guestInstructions << endl;
+    double perInstruction = guestInstructions == 0 ? 0 : 1.0 / guestInstructions;
+    for (int event = 0; event < PERF_EVENT_COUNT; event++) {
+        // Leave out counters that could not be opened, rather than reporting them as zero
+        if (groupIndex[event] == -1) {
+            continue;
+        }
+        uint64_t total = 0;
+        for (int phase = 0; phase < PERF_PHASE_COUNT; phase++) {
+            report << PHASE_NAMES[phase] << "_" << EVENT_NAMES[event] << "=" << totals[phase][event] << endl;
+            report << PHASE_NAMES[phase] << "_" << EVENT_NAMES[event] << "_per_instruction="
+                   << totals[phase][event] * perInstruction << endl;
+            total += totals[phase][event];
+        }
+        report << EVENT_NAMES[event] << "=" << total << endl;
+        report << EVENT_NAMES[event] << "_per_instruction=" << total * perInstruction << endl;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+
+// Phases of a run that host counters are attributed to
+enum PerfPhase {
+    // Reading and predecoding the binary
+    PERF_PHASE_LOAD,
+    // Fetching, dispatching and executing guest instructions, including their data memory accesses
+    PERF_PHASE_EXECUTE,
+    // Reading stdin and writing stdout for the guest
+    PERF_PHASE_MMIO,
+    PERF_PHASE_COUNT
+};
+
+enum PerfEvent {
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_EVENT_CACHE_MISSES,
+    PERF_EVENT_COUNT
+};
+
+// Host hardware counters for the calling thread, read through perf_event_open and split between the
+// phases of a run. Only user-space work is counted, so the time the kernel spends on MMIO syscalls is
+// left out. Counters the host or its permissions do not allow are reported as missing rather than failing
+// the run.
+class PerfCounters {
+private:
+    // Group leader first, or -1 when no counter could be opened
+    int fds[PERF_EVENT_COUNT];
+    // Position of each open counter in a group read, or -1
+    int groupIndex[PERF_EVENT_COUNT];
+    int openCount = 0;
+    int unavailableErrno = 0;
+
+    PerfPhase phase = PERF_PHASE_LOAD;
+    uint64_t last[PERF_EVENT_COUNT] = {};
+    uint64_t totals[PERF_PHASE_COUNT][PERF_EVENT_COUNT] = {};
+
+    // Leaves values unchanged if the counters cannot be read
+    void read(uint64_t *values);
+
+public:
+    // Open and start the counters on the calling thread, attributing to PERF_PHASE_LOAD
+    PerfCounters();
+
+    bool isAvailable() const;
+
+    // Attribute everything counted since the last call to the current phase, then switch to the given one.
+    // Must be called on the thread that constructed the counters.
+    void enter(PerfPhase phase);
+
+    // Write totals and per guest instruction ratios as key=value lines
+    void writeReport(const char *path, uint64_t guestInstructions);
+};
+
+#endif
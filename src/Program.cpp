@@ -0,0 +1,50 @@
+#include <algorithm>
+#include "Program.h"
+#include "System.h"
+
+using namespace std;
+
+Program::Program(ifstream *stream) {
+    // Read stream into memory starting at ADDR_INSTR, up to the size of instruction memory
+    char buffer[4096];
+    while (bytes.size() < MEMORY_INSTR_SIZE) {
+        stream->read(buffer, min<size_t>(sizeof(buffer), MEMORY_INSTR_SIZE - bytes.size()));
+        if (stream->gcount() == 0) {
+            break;
+        }
+        bytes.insert(bytes.end(), buffer, buffer + stream->gcount());
+    }
+
+    // Predecode every whole word, so fetching does not have to reassemble big-endian bytes
+    instructions.reserve((bytes.size() + WORD_SIZE_IN_BYTES - 1) / WORD_SIZE_IN_BYTES);
+    for (uint32_t offset = 0; offset < bytes.size(); offset += WORD_SIZE_IN_BYTES) {
+        uint32_t word = 0;
+        for (uint32_t i = 0; i < WORD_SIZE_IN_BYTES; i++) {
+            word = (word << 8) | readByte(offset + i);
+        }
+        instructions.emplace_back(word);
+    }
+
+    // Recognise loops that can run as host memory operations
+    loopIdioms.resize(instructions.size());
+    for (uint32_t index = 0; index < instructions.size(); index++) {
+        loopIdioms[index] = LoopIdiom::analyse(instructions, index);
+    }
+
+    hash = 0xcbf29ce484222325;
+    for (uint8_t byte : bytes) {
+        hash = (hash ^ byte) * 0x100000001b3;
+    }
+}
+
+shared_ptr<const Program> Program::loadFromStream(ifstream *stream) {
+    return make_shared<const Program>(stream);
+}
+
+uint32_t Program::getSize() const {
+    return static_cast<uint32_t>(bytes.size());
+}
+
+uint64_t Program::getHash() const {
+    return hash;
+}
@@ -0,0 +1,47 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Instruction.h"
+#include "LoopIdiom.h"
+
+// A loaded program image: the instruction bytes and their predecoded words. It never changes after
+// loading, so any number of Systems, each with its own registers and data memory, can share one
+// through a shared_ptr and execute from it concurrently without locking.
+class Program {
+private:
+    std::vector<uint8_t> bytes;
+    std::vector<Instruction> instructions;
+    std::vector<std::unique_ptr<const LoopIdiom>> loopIdioms;
+    uint64_t hash = 0;
+
+public:
+    explicit Program(std::ifstream *stream);
+
+    static std::shared_ptr<const Program> loadFromStream(std::ifstream *stream);
+
+    // Offsets are relative to ADDR_INSTR; anything past the end of the image reads as zero
+    uint8_t readByte(uint32_t offset) const {
+        return offset < bytes.size() ? bytes[offset] : static_cast<uint8_t>(0);
+    }
+
+    Instruction getInstruction(uint32_t offset) const {
+        uint32_t index = offset / WORD_SIZE_IN_BYTES;
+        return index < instructions.size() ? instructions[index] : Instruction(0);
+    }
+
+    // The loop idiom closed by the branch at this offset, if there is one
+    const LoopIdiom *getLoopIdiom(uint32_t offset) const {
+        uint32_t index = offset / WORD_SIZE_IN_BYTES;
+        return index < loopIdioms.size() ? loopIdioms[index].get() : nullptr;
+    }
+
+    // Size of the image in bytes, and a 64-bit FNV-1a hash of it
+    uint32_t getSize() const;
+    uint64_t getHash() const;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include "Sampler.h"
+
+using namespace std;
+
+void InstructionMix::record(Instruction instruction, bool redirected) {
+    instructions++;
+    switch (instruction.getOpcode()) {
+        case LB:
+        case LH:
+        case LBU:
+        case LW:
+        case LHU:
+        case LWL:
+        case LWR:
+            loads++;
+            return;
+        case SB:
+        case SH:
+        case SW:
+            stores++;
+            return;
+        case BEQ:
+        case BNE:
+        case BLEZ:
+        case BGTZ:
+        case B_SPEC:
+            branches++;
+            if (redirected) {
+                branchesTaken++;
+            }
+            return;
+        case J:
+        case JAL:
+            jumps++;
+            return;
+        case R:
+            break;
+        default:
+            alu++;
+            return;
+    }
+
+    switch (instruction.getFunctionCode()) {
+        case JR:
+        case JALR:
+            jumps++;
+            return;
+        case MULT:
+        case MULTU:
+        case DIV:
+        case DIVU:
+        case MFHI:
+        case MFLO:
+        case MTHI:
+        case MTLO:
+            multiplyDivide++;
+            return;
+        default:
+            alu++;
+            return;
+    }
+}
+
+void InstructionMix::add(const InstructionMix &other) {
+    instructions += other.instructions;
+    alu += other.alu;
+    multiplyDivide += other.multiplyDivide;
+    loads += other.loads;
+    stores += other.stores;
+    branches += other.branches;
+    branchesTaken += other.branchesTaken;
+    jumps += other.jumps;
+}
+
+Sampler::Sampler(shared_ptr<const Program> program, uint64_t interval) :
+        program(move(program)),
+        interval(interval) {}
+
+uint64_t Sampler::getInterval() const {
+    return interval;
+}
+
+bool Sampler::keepsNextCheckpoint() const {
+    return checkpointCount % stride == 0;
+}
+
+void Sampler::skipCheckpoint(uint64_t instructionCount) {
+    checkpointCount++;
+    lastCheckpointInstructions = instructionCount;
+}
+
+void Sampler::addCheckpoint(Checkpoint &&checkpoint) {
+    checkpointCount++;
+    lastCheckpointInstructions = checkpoint.instructionCount;
+    checkpoints.push_back(move(checkpoint));
+    if (checkpoints.size() == MAX_KEPT_CHECKPOINTS) {
+        thinCheckpoints();
+    }
+}
+
+// Merges the pages of a dropped checkpoint into the next one, whose own copy of a page is newer.
+// Pages are saved in ascending order, so both lists are merged in one pass.
+static void foldInto(const Checkpoint &dropped, Checkpoint &next) {
+    vector<uint32_t> pageNumbers;
+    vector<uint8_t> pageData;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < dropped.pageNumbers.size() || j < next.pageNumbers.size()) {
+        const Checkpoint *source;
+        size_t page;
+        if (j < next.pageNumbers.size() &&
+            (i == dropped.pageNumbers.size() || next.pageNumbers[j] <= dropped.pageNumbers[i])) {
+            if (i < dropped.pageNumbers.size() && dropped.pageNumbers[i] == next.pageNumbers[j]) {
+                i++;
+            }
+            source = &next;
+            page = j++;
+        } else {
+            source = &dropped;
+            page = i++;
+        }
+        pageNumbers.push_back(source->pageNumbers[page]);
+        const uint8_t *data = source->pageData.data() + page * DATA_PAGE_SIZE;
+        pageData.insert(pageData.end(), data, data + DATA_PAGE_SIZE);
+    }
+    next.pageNumbers = move(pageNumbers);
+    next.pageData = move(pageData);
+}
+
+void Sampler::thinCheckpoints() {
+    // Keep the checkpoints at multiples of the doubled stride, which are the even ones since the first
+    // is always kept; there is an odd number of them, so each odd one has a successor to fold into
+    vector<Checkpoint> kept;
+    for (size_t i = 0; i < checkpoints.size(); i++) {
+        if (i % 2 == 1) {
+            foldInto(checkpoints[i], checkpoints[i + 1]);
+        } else {
+            kept.push_back(move(checkpoints[i]));
+        }
+    }
+    checkpoints = move(kept);
+    stride *= 2;
+}
+
+void Sampler::logInput(int c) {
+    inputLog.push_back(c);
+}
+
+uint64_t Sampler::getInputLogSize() const {
+    return inputLog.size();
+}
+
+vector<size_t> Sampler::selectIntervals() const {
+    // The interval after a kept checkpoint is complete if another checkpoint was due after it; the last,
+    // partial interval is never replayed, since the run may have ended inside it with an error
+    size_t complete = 0;
+    while (complete < checkpoints.size() &&
+           checkpoints[complete].instructionCount + interval <= lastCheckpointInstructions) {
+        complete++;
+    }
+    size_t count = min(complete, static_cast<size_t>(MAX_SAMPLED_INTERVALS));
+
+    vector<size_t> selected;
+    for (size_t i = 0; i < count; i++) {
+        selected.push_back(i * complete / count);
+    }
+    return selected;
+}
+
+InstructionMix Sampler::replayInterval(size_t index) const {
+    shared_ptr<uint8_t> memoryData = System::allocateDataMemory();
+    for (size_t i = 0; i <= index; i++) {
+        const Checkpoint &checkpoint = checkpoints[i];
+        for (size_t page = 0; page < checkpoint.pageNumbers.size(); page++) {
+            memcpy(memoryData.get() + checkpoint.pageNumbers[page] * DATA_PAGE_SIZE,
+                   checkpoint.pageData.data() + page * DATA_PAGE_SIZE, DATA_PAGE_SIZE);
+        }
+    }
+
+    System system(program, memoryData);
+    system.restoreCheckpoint(checkpoints[index], &inputLog);
+
+    InstructionMix mix;
+    system.replay(interval, &mix);
+    return mix;
+}
+
+void Sampler::writeReport(const char *path, uint64_t totalInstructions) const {
+    vector<size_t> selected = selectIntervals();
+    vector<InstructionMix> results(selected.size());
+
+    // Each interval replays independently from its own checkpoint, so they run on all host cores
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < selected.size(); i = next++) {
+            results[i] = replayInterval(selected[i]);
+        }
+    };
+    size_t threadCount = min(static_cast<size_t>(max(thread::hardware_concurrency(), 1U)), selected.size());
+    vector<thread> threads;
+    for (size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (thread &replayThread : threads) {
+        replayThread.join();
+    }
+
+    InstructionMix sampled;
+    for (const InstructionMix &result : results) {
+        sampled.add(result);
+    }
+
+    // Scale the sampled counts up to the number of instructions the whole run executed
+    double scale = sampled.instructions == 0 ? 0 : static_cast<double>(totalInstructions) / sampled.instructions;
+    auto estimate = [scale](uint64_t count) {
+        return static_cast<uint64_t>(llround(count * scale));
+    };
+
+    ofstream report(path);
+    report << "instructions=" << totalInstructions << endl;
+    report << "intervals=" << (checkpointCount == 0 ? 0 : checkpointCount - 1) << endl;
+    report << "sampled_intervals=" << selected.size() << endl;
+    report << "sampled_instructions=" << sampled.instructions << endl;
+    report << "estimated_alu=" << estimate(sampled.alu) << endl;
+    report << "estimated_multiply_divide=" << estimate(sampled.multiplyDivide) << endl;
+    report << "estimated_loads=" << estimate(sampled.loads) << endl;
+    report << "estimated_stores=" << estimate(sampled.stores) << endl;
+    report << "estimated_branches=" << estimate(sampled.branches) << endl;
+    report << "estimated_branches_taken=" << estimate(sampled.branchesTaken) << endl;
+    report << "estimated_jumps=" << estimate(sampled.jumps) << endl;
+}
@@ -0,0 +1,90 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Instruction.h"
+#include "Program.h"
+#include "System.h"
+
+#define DEFAULT_SAMPLE_INTERVAL 10000000
+
+// At most this many intervals are replayed in detail, spread evenly over the run
+#define MAX_SAMPLED_INTERVALS 64
+
+// Checkpoints kept before every other one is folded into the next, bounding memory whatever the run length.
+// Odd, so that the last checkpoint kept is never the one folded.
+#define MAX_KEPT_CHECKPOINTS (2 * MAX_SAMPLED_INTERVALS + 1)
+
+// The architectural state of a single hart between two instructions. Data memory is stored as the
+// pages written since the previous kept checkpoint, so memory at kept checkpoint k is the pages of kept
+// checkpoints 0 to k applied in order over zeroed memory.
+struct Checkpoint {
+    uint64_t instructionCount;
+    uint32_t pc;
+    uint32_t nextPC;
+    uint64_t hiLo;
+    uint32_t registers[REGISTERS_SIZE];
+    uint32_t amoAddress;
+    uint32_t amoOperand;
+
+    // Number of characters read from stdin so far, as an offset into the Sampler's input log
+    uint64_t inputOffset;
+
+    std::vector<uint32_t> pageNumbers;
+    std::vector<uint8_t> pageData;
+};
+
+// What the detailed replay of an interval measures
+struct InstructionMix {
+    uint64_t instructions = 0;
+    uint64_t alu = 0;
+    uint64_t multiplyDivide = 0;
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t branches = 0;
+    uint64_t branchesTaken = 0;
+    uint64_t jumps = 0;
+
+    void record(Instruction instruction, bool redirected);
+    void add(const InstructionMix &other);
+};
+
+// Sampled simulation of long runs. The normal run is the fast functional pass: it saves a checkpoint
+// every interval instructions and logs stdin. When it ends, a sample of the complete intervals is
+// replayed from their checkpoints in parallel, and the instruction mix is extrapolated to the whole run.
+class Sampler {
+private:
+    std::shared_ptr<const Program> program;
+    uint64_t interval;
+    std::vector<Checkpoint> checkpoints;
+    std::vector<int> inputLog;
+
+    // Only every stride-th checkpoint is kept; the stride doubles each time the kept ones are thinned out
+    uint64_t stride = 1;
+    uint64_t checkpointCount = 0;
+    uint64_t lastCheckpointInstructions = 0;
+
+    void thinCheckpoints();
+
+    std::vector<size_t> selectIntervals() const;
+    InstructionMix replayInterval(size_t index) const;
+
+public:
+    Sampler(std::shared_ptr<const Program> program, uint64_t interval);
+
+    uint64_t getInterval() const;
+
+    // Whether the checkpoint due next is kept. If not, it is skipped, and the pages written in its interval
+    // stay dirty so that the next kept checkpoint saves them.
+    bool keepsNextCheckpoint() const;
+    void skipCheckpoint(uint64_t instructionCount);
+    void addCheckpoint(Checkpoint &&checkpoint);
+    void logInput(int c);
+    uint64_t getInputLogSize() const;
+
+    void writeReport(const char *path, uint64_t totalInstructions) const;
+};
+
+#endif
@@ -2,13 +2,108 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <cstdio>
 #include <dirent.h>
+#include <sys/stat.h>
 #include "Instruction.h"
+#include "Program.h"
 #include "System.h"
+#include "TraceCache.h"
+#include "Sampler.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
 #include "Errors.h"
 
 using namespace std;
 
+// Used by writeStats, which runs from atexit as the simulator exits from inside System
+static vector<System *> simulatedSystems;
+static vector<TraceCache *> traceCaches;
+static shared_ptr<const Program> simulatedProgram;
+static const char *statsPath = nullptr;
+static Coverage *coverage = nullptr;
+static const char *coveragePath = nullptr;
+static Sampler *sampler = nullptr;
+static string traceCachePath;
+static const char *samplePath = nullptr;
+static MetricsWriter *metricsWriter = nullptr;
+static PerfCounters *perfCounters = nullptr;
+static const char *perfPath = nullptr;
+
+// A hart other than 0 that fails exits from its own thread, so the handlers then run while hart 0 is still
+// executing; anything only hart 0's thread may touch is skipped in that case
+static thread::id hartZeroThread;
+
+static bool onHartZeroThread() {
+    return this_thread::get_id() == hartZeroThread;
+}
+
+static void writeStats() {
+    // Harts other than the one exiting may still be running, so their counts are the last they published
+    uint64_t instructions = 0;
+    for (System *system : simulatedSystems) {
+        instructions += system->getPublishedInstructionCount();
+    }
+
+    ofstream stats(statsPath);
+    stats << "instructions=" << instructions << endl;
+
+    uint64_t tracesFormed = 0;
+    uint64_t tracesInvalidated = 0;
+    uint64_t tracesLoaded = 0;
+    for (TraceCache *traceCache : traceCaches) {
+        tracesFormed += traceCache->getTracesFormed();
+        tracesInvalidated += traceCache->getTracesInvalidated();
+        tracesLoaded += traceCache->getTracesLoaded();
+    }
+    stats << "traces_formed=" << tracesFormed << endl;
+    stats << "traces_invalidated=" << tracesInvalidated << endl;
+    stats << "traces_loaded=" << tracesLoaded << endl;
+}
+
+static void writeCoverage() {
+    coverage->writeToFile(coveragePath, simulatedProgram->getHash());
+}
+
+static void writeSamples() {
+    sampler->writeReport(samplePath, simulatedSystems[0]->getInstructionCount());
+}
+
+static void writeTraceCache() {
+    // Every hart runs the same program, so hart 0's profile stands for the run. The cache is best effort,
+    // so a run that failed on another hart just leaves the previous file in place.
+    if (onHartZeroThread()) {
+        traceCaches[0]->saveToFile(traceCachePath.c_str());
+    }
+}
+
+static void writeMetrics() {
+    // Other harts publish on their own threads, so only hart 0's counters are brought up to date
+    if (onHartZeroThread()) {
+        simulatedSystems[0]->publishMetrics();
+    }
+    metricsWriter->finish();
+}
+
+static void writePerf() {
+    // The counters follow hart 0's thread and are updated by it, so they cannot be read from another
+    if (onHartZeroThread()) {
+        perfCounters->writeReport(perfPath, simulatedSystems[0]->getInstructionCount());
+    }
+}
+
+static uint64_t parsePositiveNumber(const char *text, const char *description) {
+    char *end = nullptr;
+    uint64_t number = strtoull(text, &end, 10);
+    if (*end != '\0' || number == 0) {
+        cerr << "Invalid " << description << " " << text << endl;
+        exit(ERROR_INTERNAL);
+    }
+    return number;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -16,6 +111,67 @@ int main(int argc, char *argv[])
         exit(ERROR_INTERNAL);
     }
 
+    hartZeroThread = this_thread::get_id();
+
+    // Optional flags after the binary, used by the benchmark suite and testbench
+    uint64_t instructionBudget = NO_INSTRUCTION_BUDGET;
+    uint64_t hartCount = 1;
+    bool traces = true;
+    bool loopIdioms = true;
+    uint64_t sampleInterval = DEFAULT_SAMPLE_INTERVAL;
+    const char *cacheDirectory = nullptr;
+    const char *metricsPath = nullptr;
+    uint64_t metricsInterval = DEFAULT_METRICS_INTERVAL_MS;
+    for (int i = 2; i < argc; i++) {
+        string option(argv[i]);
+        if (option == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (option == "--coverage" && i + 1 < argc) {
+            coveragePath = argv[++i];
+        } else if (option == "--max-instructions" && i + 1 < argc) {
+            instructionBudget = parsePositiveNumber(argv[++i], "instruction budget");
+        } else if (option == "--harts" && i + 1 < argc) {
+            hartCount = parsePositiveNumber(argv[++i], "number of harts");
+        } else if (option == "--sample" && i + 1 < argc) {
+            samplePath = argv[++i];
+        } else if (option == "--sample-interval" && i + 1 < argc) {
+            sampleInterval = parsePositiveNumber(argv[++i], "sample interval");
+        } else if (option == "--cache-dir" && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        } else if (option == "--metrics" && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (option == "--metrics-interval" && i + 1 < argc) {
+            metricsInterval = parsePositiveNumber(argv[++i], "metrics interval");
+        } else if (option == "--perf" && i + 1 < argc) {
+            perfPath = argv[++i];
+        } else if (option == "--no-traces") {
+            traces = false;
+        } else if (option == "--no-idioms") {
+            loopIdioms = false;
+        } else {
+            cerr << "Unrecognised option " << option << endl;
+            exit(ERROR_INTERNAL);
+        }
+    }
+
+    if (hartCount > MAX_HARTS) {
+        cerr << "At most " << MAX_HARTS << " harts are supported." << endl;
+        exit(ERROR_INTERNAL);
+    }
+    if (hartCount > 1 && coveragePath != nullptr) {
+        cerr << "Coverage can only be recorded with a single hart." << endl;
+        exit(ERROR_INTERNAL);
+    }
+    if (hartCount > 1 && samplePath != nullptr) {
+        cerr << "Sampling is only supported with a single hart." << endl;
+        exit(ERROR_INTERNAL);
+    }
+
+    // Host counters only follow the main thread, so they cover loading and hart 0
+    if (perfPath != nullptr) {
+        perfCounters = new PerfCounters();
+    }
+
     // Open specified binary and attempt to load into memory
     auto *binary = new ifstream();
     binary->open(argv[1], ios::binary);
@@ -25,9 +181,79 @@ int main(int argc, char *argv[])
         exit(ERROR_INTERNAL);
     }
 
-    auto *system = new System();
-    system->loadInstructionsFromStream(binary);
-    system->start();
+    // Every hart runs the same program over the same data memory, each with its own registers
+    simulatedProgram = Program::loadFromStream(binary);
+    shared_ptr<uint8_t> memoryData = System::allocateDataMemory();
+
+    // Profiles and traces from earlier runs of the same program; the cache is best effort, so a
+    // directory that cannot be created or written just means starting cold
+    if (cacheDirectory != nullptr && traces) {
+        mkdir(cacheDirectory, 0777);
+        char name[64];
+        snprintf(name, sizeof(name), "/%016llx-v%d.trc",
+                 static_cast<unsigned long long>(simulatedProgram->getHash()), TRACE_CACHE_VERSION);
+        traceCachePath = string(cacheDirectory) + name;
+    }
+    for (uint32_t hartId = 0; hartId < hartCount; hartId++) {
+        auto *system = new System(simulatedProgram, memoryData, hartId, static_cast<uint32_t>(hartCount));
+        system->setInstructionBudget(instructionBudget);
+        if (!loopIdioms) {
+            system->disableLoopIdioms();
+        }
+        // Branch profiles differ between harts, so each forms its own traces
+        if (traces) {
+            auto *traceCache = new TraceCache(simulatedProgram);
+            if (!traceCachePath.empty()) {
+                traceCache->loadFromFile(traceCachePath.c_str());
+            }
+            system->setTraceCache(traceCache);
+            traceCaches.push_back(traceCache);
+        }
+        simulatedSystems.push_back(system);
+    }
+
+    if (statsPath != nullptr) {
+        atexit(writeStats);
+    }
+    if (coveragePath != nullptr) {
+        coverage = new Coverage(MEMORY_INSTR_SIZE / WORD_SIZE_IN_BYTES,
+                                (simulatedProgram->getSize() + WORD_SIZE_IN_BYTES - 1) / WORD_SIZE_IN_BYTES);
+        simulatedSystems[0]->setCoverage(coverage);
+        atexit(writeCoverage);
+    }
+    if (!traceCachePath.empty()) {
+        atexit(writeTraceCache);
+    }
+    if (samplePath != nullptr) {
+        sampler = new Sampler(simulatedProgram, sampleInterval);
+        simulatedSystems[0]->setSampler(sampler);
+        atexit(writeSamples);
+    }
+    if (metricsPath != nullptr) {
+        vector<HartMetrics *> hartMetrics;
+        for (System *system : simulatedSystems) {
+            auto *metrics = new HartMetrics();
+            system->setMetrics(metrics);
+            hartMetrics.push_back(metrics);
+        }
+        metricsWriter = new MetricsWriter(metricsPath, hartMetrics, metricsInterval);
+        metricsWriter->start();
+        atexit(writeMetrics);
+    }
+
+    // Registered last so that it runs first at exit, before the other reports add to the counts
+    if (perfPath != nullptr) {
+        simulatedSystems[0]->setPerfCounters(perfCounters);
+        perfCounters->enter(PERF_PHASE_EXECUTE);
+        atexit(writePerf);
+    }
+
+    // Hart 0 runs on the main thread and exits the whole program when it finishes. A hart that fails exits
+    // from its own thread and destroys simulatedSystems, so it is not read once the first hart starts.
+    vector<System *> harts = simulatedSystems;
+    for (uint32_t hartId = 1; hartId < hartCount; hartId++) {
+        thread(&System::start, harts[hartId]).detach();
+    }
+    harts[0]->start();
     return 0;
 }
-
@@ -2,72 +2,377 @@
 #include <bitset>
 #include "System.h"
 #include "Instruction.h"
+#include "TraceCache.h"
+#include "Sampler.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
 #include "Errors.h"
+#include <algorithm>
+#include <atomic>
 #include <limits>
+#include <cstring>
+#include <unistd.h>
+
+constexpr OpcodeTable System::makeOpcodeTable() {
+    OpcodeTable table = {};
+    for (auto &handler : table.handlers) {
+        handler = &System::_invalid;
+    }
+
+    table.handlers[R] = &System::executeRTypeInstruction;
+    table.handlers[ADDIU] = &System::_addiu;
+    table.handlers[SLTI] = &System::_slti;
+    table.handlers[SLTIU] = &System::_sltiu;
+    table.handlers[ANDI] = &System::_andi;
+    table.handlers[ORI] = &System::_ori;
+    table.handlers[XORI] = &System::_xori;
+    table.handlers[LUI] = &System::_lui;
+    table.handlers[BEQ] = &System::_beq;
+    table.handlers[BNE] = &System::_bne;
+    table.handlers[BLEZ] = &System::_blez;
+    table.handlers[BGTZ] = &System::_bgtz;
+    table.handlers[B_SPEC] = &System::_b_spec;
+    table.handlers[LB] = &System::_lb;
+    table.handlers[LH] = &System::_lh;
+    table.handlers[LBU] = &System::_lbu;
+    table.handlers[LW] = &System::_lw;
+    table.handlers[SB] = &System::_sb;
+    table.handlers[SH] = &System::_sh;
+    table.handlers[SW] = &System::_sw;
+    table.handlers[ADDI] = &System::_addi;
+    table.handlers[LHU] = &System::_lhu;
+    table.handlers[LWL] = &System::_lwl;
+    table.handlers[LWR] = &System::_lwr;
+    table.handlers[J] = &System::_j;
+    table.handlers[JAL] = &System::_jal;
+    return table;
+}
+
+constexpr FunctionCodeTable System::makeFunctionCodeTable() {
+    FunctionCodeTable table = {};
+    for (auto &handler : table.handlers) {
+        handler = &System::_invalid;
+    }
+
+    table.handlers[SLL] = &System::_sll;
+    table.handlers[SRL] = &System::_srl;
+    table.handlers[SRA] = &System::_sra;
+    table.handlers[ADD] = &System::_add;
+    table.handlers[ADDU] = &System::_addu;
+    table.handlers[SUB] = &System::_sub;
+    table.handlers[SUBU] = &System::_subu;
+    table.handlers[AND] = &System::_and;
+    table.handlers[OR] = &System::_or;
+    table.handlers[XOR] = &System::_xor;
+    table.handlers[SLT] = &System::_slt;
+    table.handlers[SLTU] = &System::_sltu;
+    table.handlers[JR] = &System::_jr;
+    table.handlers[JALR] = &System::_jalr;
+    table.handlers[DIV] = &System::_div;
+    table.handlers[DIVU] = &System::_divu;
+    table.handlers[MFHI] = &System::_mfhi;
+    table.handlers[MFLO] = &System::_mflo;
+    table.handlers[MTHI] = &System::_mthi;
+    table.handlers[MTLO] = &System::_mtlo;
+    table.handlers[MULT] = &System::_mult;
+    table.handlers[MULTU] = &System::_multu;
+    table.handlers[SLLV] = &System::_sllv;
+    table.handlers[SRAV] = &System::_srav;
+    table.handlers[SRLV] = &System::_srlv;
+    return table;
+}
+
+const OpcodeTable System::opcodeTable = System::makeOpcodeTable();
+const FunctionCodeTable System::functionCodeTable = System::makeFunctionCodeTable();
+
+// Guest memory is big-endian
+static inline uint32_t toGuestWord(uint32_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap32(word);
+#else
+    return word;
+#endif
+}
+
+static inline uint16_t toGuestHalfWord(uint16_t halfWord) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap16(halfWord);
+#else
+    return halfWord;
+#endif
+}
+
+System::System(std::shared_ptr<const Program> program, std::shared_ptr<uint8_t> memoryData,
+               uint32_t hartId, uint32_t hartCount) :
+        // Another hart could observe a loop's stores happening all at once
+        loopIdiomsEnabled(hartCount == 1),
+        inputIsTerminal(isatty(STDIN_FILENO) != 0),
+        program(std::move(program)),
+        memoryData(std::move(memoryData)),
+        dirtyPages(MEMORY_DATA_SIZE / DATA_PAGE_SIZE),
+        hartId(hartId),
+        hartCount(hartCount) {}
+
+std::shared_ptr<uint8_t> System::allocateDataMemory() {
+    auto *memory = static_cast<uint8_t *>(calloc(MEMORY_DATA_SIZE, 1));
+    if (memory == nullptr) {
+        cerr << "Unable to allocate data memory" << endl;
+        exit(ERROR_INTERNAL);
+    }
+    return std::shared_ptr<uint8_t>(memory, FreeDeleter());
+}
+
+// Set by the first hart to end the program
+static std::atomic<bool> exiting(false);
+
+void System::exitProgram(int exitCode) {
+    // exit() is not safe to call from two threads at once, so a hart that fails, or hart 0 finishing, while
+    // another hart is already exiting just waits for the process to end with that hart's exit code
+    if (exiting.exchange(true)) {
+        for (;;) {
+            pause();
+        }
+    }
+    publishedInstructionCount.store(instructionCount, memory_order_relaxed);
+    exit(exitCode);
+}
 
 void System::start() {
     while (pc != ADDR_NULL) {
-        if (pc >= ADDR_INSTR && pc <= ADDR_INSTR + MEMORY_INSTR_SIZE) {
-            auto *instruction = new Instruction(readMemoryWord(pc));
-            executeInstruction(instruction);
+        if (!step() && (pendingTrace != nullptr || pendingIdiom != nullptr)) {
+            enterLoop();
+        }
+    }
+
+    publishedInstructionCount.store(instructionCount, memory_order_relaxed);
+
+    // Only hart 0 ends the program; other harts just stop
+    if (hartId == 0) {
+        exitProgram(getExitCode());
+    }
+}
+
+inline Instruction System::fetch() {
+    if (pc >= ADDR_INSTR && pc < ADDR_INSTR + MEMORY_INSTR_SIZE && pc % WORD_SIZE_IN_BYTES == 0) {
+        return program->getInstruction(pc - ADDR_INSTR);
+    }
+    cerr << "Attempted to execute an instruction outside of executable memory" << endl;
+    exitProgram(ERROR_CPU_EXCEPTION);
+}
+
+inline bool System::step() {
+    Instruction instruction = fetch();
+    return executeAndAdvance(&instruction, opcodeTable.handlers[instruction.getOpcode()]);
+}
+
+inline bool System::executeAndAdvance(Instruction *instruction, InstructionHandler handler) {
+    if (coverage != nullptr) {
+        coverage->recordInstruction((pc - ADDR_INSTR) / WORD_SIZE_IN_BYTES, instruction);
+    }
+    (this->*handler)(instruction);
+
+    bool advanced = updatePC;
+    if (advanced) {
+        incrementPC(WORD_SIZE_IN_BYTES);
+    }
+    updatePC = true;
+
+    if (++instructionCount == nextEvent) {
+        handleEvent();
+    }
+    return advanced;
+}
+
+void System::enterLoop() {
+    // A taken backward branch left a loop to enter; run its delay slot, then the loop if pc reached it
+    Trace *trace = pendingTrace;
+    const LoopIdiom *idiom = pendingIdiom;
+    pendingTrace = nullptr;
+    pendingIdiom = nullptr;
+    step();
+
+    if (idiom != nullptr && pc == idiom->entry && runLoopIdiom(idiom)) {
+        return;
+    }
+    if (trace != nullptr && pc == trace->entry) {
+        runTrace(trace);
+    }
+}
+
+// Whether [address, address + bytes) lies entirely in data memory
+static bool isDataRange(uint32_t address, uint64_t bytes) {
+    return address - ADDR_DATA < MEMORY_DATA_SIZE && address - ADDR_DATA + bytes <= MEMORY_DATA_SIZE;
+}
+
+bool System::runLoopIdiom(const LoopIdiom *idiom) {
+    // Called at the top of an iteration; every value below is relative to the registers at this point
+    uint32_t start[REGISTERS_SIZE];
+    memcpy(start, registers, sizeof(registers));
+    auto valueAt = [&](const LoopValue &value, uint64_t iteration) {
+        return static_cast<uint32_t>(start[value.base] + iteration * idiom->steps[value.base] + value.offset);
+    };
+    const LoopValue &left = idiom->conditionLeft;
+    const LoopValue &right = idiom->conditionRight;
+    uint8_t *memory = memoryData.get() - ADDR_DATA;
+
+    uint64_t iterations;
+    if (left.loaded || right.loaded) {
+        // Scan for the byte that ends the loop; if it can never match, or is not in data memory,
+        // the loop runs off the end and faults, so leave that to the interpreter
+        uint32_t needle = valueAt(left.loaded ? right : left, 0);
+        bool matches = idiom->load.signExtend ? static_cast<int32_t>(needle) == static_cast<int8_t>(needle)
+                                              : needle <= MASK_BYTE;
+        uint32_t address = valueAt(idiom->load.address, 0);
+        if (!matches || !isDataRange(address, 1)) {
+            rejectedIdiom = idiom;
+            return false;
+        }
+        auto *found = static_cast<uint8_t *>(memchr(memory + address, static_cast<uint8_t>(needle),
+                                                    ADDR_DATA + MEMORY_DATA_SIZE - address));
+        if (found == nullptr) {
+            rejectedIdiom = idiom;
+            return false;
+        }
+        iterations = found - (memory + address) + 1;
+    } else {
+        // Iteration i sees the difference plus i times the closing rate, a power of two, and the last
+        // iteration is the one where that is zero; if it is never exactly zero the loop does not end
+        uint32_t difference = valueAt(left, 0) - valueAt(right, 0);
+        int32_t closing = idiom->steps[left.base] - idiom->steps[right.base];
+        uint32_t distance = closing > 0 ? -difference : difference;
+        uint32_t magnitude = closing > 0 ? static_cast<uint32_t>(closing) : -static_cast<uint32_t>(closing);
+        if ((distance & (magnitude - 1)) != 0) {
+            rejectedIdiom = idiom;
+            return false;
+        }
+        iterations = (distance >> __builtin_ctz(magnitude)) + 1;
+    }
+
+    // Stop short of the next budget or checkpoint, and let the interpreter carry on from there
+    uint64_t count = min(iterations, (nextEvent - instructionCount) / idiom->length);
+    if (count == 0) {
+        return false;
+    }
+
+    uint32_t loadAddress = 0;
+    if (idiom->hasLoad) {
+        loadAddress = valueAt(idiom->load.address, 0);
+        if (!isDataRange(loadAddress, count * idiom->load.width) || loadAddress % idiom->load.width != 0) {
+            rejectedIdiom = idiom;
+            return false;
+        }
+    }
+    if (idiom->hasStore) {
+        uint32_t storeAddress = valueAt(idiom->store.address, 0);
+        uint64_t bytes = count * idiom->store.width;
+        if (!isDataRange(storeAddress, bytes) || storeAddress % idiom->store.width != 0) {
+            rejectedIdiom = idiom;
+            return false;
+        }
+
+        if (idiom->storeValue.loaded) {
+            // Copying forwards matches memmove unless the destination starts inside the source
+            if (storeAddress > loadAddress && storeAddress < loadAddress + bytes) {
+                rejectedIdiom = idiom;
+                return false;
+            }
+            memmove(memory + storeAddress, memory + loadAddress, bytes);
+        } else if (idiom->hasLoad && storeAddress < loadAddress + count * idiom->load.width &&
+                   loadAddress < storeAddress + bytes) {
+            // Storing a constant where the loop also loads would change what later iterations read, and
+            // the loaded registers are read back from memory below
+            rejectedIdiom = idiom;
+            return false;
+        } else if (idiom->store.width == 1) {
+            memset(memory + storeAddress, static_cast<uint8_t>(valueAt(idiom->storeValue, 0)), bytes);
         } else {
-            cerr << "Attempted to execute an instruction outside of executable memory" << endl;
-            exit(ERROR_CPU_EXCEPTION);
+            auto *target = reinterpret_cast<uint32_t *>(memory + storeAddress);
+            fill(target, target + count, toGuestWord(valueAt(idiom->storeValue, 0)));
         }
 
-        if (updatePC) {
-            incrementPC(WORD_SIZE_IN_BYTES);
+        uint32_t firstPage = (storeAddress - ADDR_DATA) / DATA_PAGE_SIZE;
+        uint32_t lastPage = (storeAddress - ADDR_DATA + bytes - 1) / DATA_PAGE_SIZE;
+        fill(dirtyPages.begin() + firstPage, dirtyPages.begin() + lastPage + 1, DATA_PAGE_DIRTY | DATA_PAGE_TOUCHED);
+        sideEffect = true;
+    }
+
+    // Each register ends as it did after the last iteration, relative to the start of that iteration
+    for (uint8_t reg = 1; reg < REGISTERS_SIZE; reg++) {
+        const LoopValue &result = idiom->results[reg];
+        if (!result.loaded) {
+            registers[reg] = valueAt(result, count - 1);
+            continue;
+        }
+        uint32_t address = loadAddress + (count - 1) * idiom->load.width;
+        if (idiom->load.width == WORD_SIZE_IN_BYTES) {
+            registers[reg] = readMemoryWord(address);
+        } else if (idiom->load.signExtend) {
+            registers[reg] = static_cast<uint32_t>(static_cast<int32_t>(static_cast<int8_t>(memory[address])));
+        } else {
+            registers[reg] = memory[address];
         }
-        updatePC = true;
     }
 
-    exit(getExitCode());
-}
+    instructionCount += count * idiom->length;
+    if (count == iterations) {
+        pc = idiom->exit;
+        nextPC = idiom->exit + WORD_SIZE_IN_BYTES;
+    }
+    rejectedIdiom = nullptr;
+    loopIdiomsRun++;
+
+    if (instructionCount == nextEvent) {
+        handleEvent();
+    }
+    return true;
+}
+
+void System::runTrace(Trace *trace) {
+    const vector<TraceOp> &ops = trace->ops;
+    size_t i = 0;
+    uint64_t iterations = 0;
+
+    // Each instruction is guarded by the address it was formed at, so a branch going the cold way
+    // leaves the trace at the first instruction off its path
+    while (pc == ops[i].address) {
+        Instruction instruction = ops[i].instruction;
+        executeAndAdvance(&instruction, ops[i].handler);
+        if (++i == ops.size()) {
+            i = 0;
+            iterations++;
+        }
+    }
 
-void System::loadInstructionsFromStream(ifstream *stream) {
-    // Read stream into memory starting at ADDR_INSTR
-    stream->read((char *) memoryInstr, MEMORY_INSTR_SIZE);
+    // The trace's own loop branch leaves it pending, and it may be deleted below
+    pendingTrace = nullptr;
+
+    // Leaving at the entry means the loop finished or the trace ended; anywhere else is a side exit
+    traceCache->recordExit(trace, i != 0 ? iterations + 1 : iterations, i != 0);
 }
 
 void System::executeInstruction(Instruction *instruction) {
-    switch (instruction->getOpcode()) {
-        case R: executeRTypeInstruction(instruction); break;
-        case ADDIU: _addiu(instruction); break;
-        case SLTI: _slti(instruction); break;
-        case SLTIU: _sltiu(instruction); break;
-        case ANDI: _andi(instruction); break;
-        case ORI: _ori(instruction); break;
-        case XORI: _xori(instruction); break;
-        case LUI: _lui(instruction); break;
-        case BEQ: _beq(instruction); break;
-        case BNE: _bne(instruction); break;
-        case BLEZ: _blez(instruction); break;
-        case BGTZ: _bgtz(instruction); break;
-        case B_SPEC: _b_spec(instruction); break;
-        case LB: _lb(instruction); break;
-        case LH: _lh(instruction); break;
-        case LBU: _lbu(instruction); break;
-        case LW: _lw(instruction); break;
-        case SB: _sb(instruction); break;
-        case SH: _sh(instruction); break;
-        case SW: _sw(instruction); break;
-        case ADDI: _addi(instruction); break;
-        case LHU: _lhu(instruction); break;
-        case LWL: _lwl(instruction); break;
-        case LWR: _lwr(instruction); break;
-        case J: _j(instruction); break;
-        case JAL: _jal(instruction); break;
-    }
+    (this->*opcodeTable.handlers[instruction->getOpcode()])(instruction);
 }
 
 uint32_t System::readMemoryWord(uint32_t address) {
     if (address % WORD_SIZE_IN_BYTES != 0) {
         cerr << "Attempted to read a word on a non aligned memory address " << std::hex << address << endl;
-        exit(ERROR_CPU_EXCEPTION);
+        exitProgram(ERROR_CPU_EXCEPTION);
+    }
+
+    // Aligned, so the whole word is in data memory
+    if (address - ADDR_DATA < MEMORY_DATA_SIZE) {
+        auto *word = reinterpret_cast<uint32_t *>(memoryData.get() + (address - ADDR_DATA));
+        return toGuestWord(__atomic_load_n(word, __ATOMIC_RELAXED));
     }
 
-    if (address == ADDR_GETC) {
-        return static_cast<uint32_t>(getchar());
+    switch (address) {
+        case ADDR_GETC: return readInput();
+        case ADDR_HART_ID: return hartId;
+        case ADDR_HART_COUNT: return hartCount;
+        case ADDR_AMO_SWAP: return atomicSwap();
+        case ADDR_AMO_ADD: return atomicAdd();
+        default: break;
     }
 
     uint32_t result = 0;
@@ -79,27 +384,32 @@ uint32_t System::readMemoryWord(uint32_t address) {
 
 uint8_t System::readMemoryByte(uint32_t address) {
     if (address >= ADDR_INSTR && address < ADDR_INSTR + MEMORY_INSTR_SIZE) {
-        return memoryInstr[address - ADDR_INSTR];
+        return program->readByte(address - ADDR_INSTR);
     }
     if (address >= ADDR_DATA && address < ADDR_DATA + MEMORY_DATA_SIZE) {
-        return memoryData[address - ADDR_DATA];
+        return __atomic_load_n(memoryData.get() + (address - ADDR_DATA), __ATOMIC_RELAXED);
     }
     if (address >= ADDR_GETC && address < ADDR_GETC + 4) {
-        return static_cast<uint8_t>((getchar() >> ((3 - address + ADDR_GETC) * 8)) & MASK_BYTE);
+        return static_cast<uint8_t>((readInput() >> ((3 - address + ADDR_GETC) * 8)) & MASK_BYTE);
     }
 
     cerr << "Attempted to read a byte from an invalid or write-only memory address " << std::hex << address << endl;
-    exit(ERROR_CPU_EXCEPTION);
+    exitProgram(ERROR_CPU_EXCEPTION);
 }
 
 uint16_t System::readMemoryHalfWord(uint32_t address) {
     if (address % HALF_WORD_SIZE_IN_BYTES != 0) {
         cerr << "Attempted to read a half word on a non aligned memory address " << std::hex << address << endl;
-        exit(ERROR_CPU_EXCEPTION);
+        exitProgram(ERROR_CPU_EXCEPTION);
+    }
+
+    if (address - ADDR_DATA < MEMORY_DATA_SIZE) {
+        auto *halfWord = reinterpret_cast<uint16_t *>(memoryData.get() + (address - ADDR_DATA));
+        return toGuestHalfWord(__atomic_load_n(halfWord, __ATOMIC_RELAXED));
     }
 
     if (address == ADDR_GETC || address == ADDR_GETC + HALF_WORD_SIZE_IN_BYTES) {
-        return static_cast<uint16_t>((getchar() >> ((1 - ((address - ADDR_GETC) / 2)) * 16)) & MASK_HALF_WORD);
+        return static_cast<uint16_t>((readInput() >> ((1 - ((address - ADDR_GETC) / 2)) * 16)) & MASK_HALF_WORD);
     }
 
     uint16_t result = 0;
@@ -112,14 +422,24 @@ uint16_t System::readMemoryHalfWord(uint32_t address) {
 void System::writeMemoryWord(uint32_t address, uint32_t word) {
     if (address % WORD_SIZE_IN_BYTES != 0) {
         cerr << "Attempted to write a word on a non aligned memory address " << std::hex << address << endl;
-        exit(ERROR_CPU_EXCEPTION);
+        exitProgram(ERROR_CPU_EXCEPTION);
     }
 
-    if (address == ADDR_PUTC) {
-        putchar(word);
+    if (address - ADDR_DATA < MEMORY_DATA_SIZE) {
+        auto *target = reinterpret_cast<uint32_t *>(memoryData.get() + (address - ADDR_DATA));
+        __atomic_store_n(target, toGuestWord(word), __ATOMIC_RELAXED);
+        markWritten(address);
+        sideEffect = true;
         return;
     }
 
+    switch (address) {
+        case ADDR_PUTC: writeOutput(word); return;
+        case ADDR_AMO_ADDRESS: amoAddress = word; return;
+        case ADDR_AMO_OPERAND: amoOperand = word; return;
+        default: break;
+    }
+
     for (uint8_t i = 0; i < WORD_SIZE_IN_BYTES; i++) {
         auto byte = static_cast<uint8_t>(word >> (8 * (WORD_SIZE_IN_BYTES - i - 1)) & MASK_BYTE);
         writeMemoryByte(address + i, byte);
@@ -128,26 +448,36 @@ void System::writeMemoryWord(uint32_t address, uint32_t word) {
 
 void System::writeMemoryByte(uint32_t address, uint8_t byte) {
     if (address >= ADDR_DATA && address < ADDR_DATA + MEMORY_DATA_SIZE) {
-        memoryData[address - ADDR_DATA] = byte;
+        __atomic_store_n(memoryData.get() + (address - ADDR_DATA), byte, __ATOMIC_RELAXED);
+        markWritten(address);
+        sideEffect = true;
         return;
     }
     if (address >= ADDR_PUTC && address < ADDR_PUTC + 4) {
-        putchar(byte << ((3 - address + ADDR_PUTC) * 8));
+        writeOutput(byte << ((3 - address + ADDR_PUTC) * 8));
         return;
     }
 
     cerr << "Attempted to write to an invalid or read-only memory address " << std::hex << address << endl;
-    exit(ERROR_CPU_EXCEPTION);
+    exitProgram(ERROR_CPU_EXCEPTION);
 }
 
 void System::writeMemoryHalfWord(uint32_t address, uint16_t halfWord) {
     if (address % HALF_WORD_SIZE_IN_BYTES != 0) {
         cerr << "Attempted to write a half word on a non aligned memory address " << std::hex << address << endl;
-        exit(ERROR_CPU_EXCEPTION);
+        exitProgram(ERROR_CPU_EXCEPTION);
+    }
+
+    if (address - ADDR_DATA < MEMORY_DATA_SIZE) {
+        auto *target = reinterpret_cast<uint16_t *>(memoryData.get() + (address - ADDR_DATA));
+        __atomic_store_n(target, toGuestHalfWord(halfWord), __ATOMIC_RELAXED);
+        markWritten(address);
+        sideEffect = true;
+        return;
     }
 
     if (address == ADDR_PUTC || address == ADDR_PUTC + WORD_SIZE_IN_BYTES) {
-        putchar(halfWord << ((1 - ((address - ADDR_PUTC) / 2)) * 16));
+        writeOutput(halfWord << ((1 - ((address - ADDR_PUTC) / 2)) * 16));
         return;
     }
 
@@ -157,18 +487,87 @@ void System::writeMemoryHalfWord(uint32_t address, uint16_t halfWord) {
     }
 }
 
+inline void System::markWritten(uint32_t address) {
+    dirtyPages[(address - ADDR_DATA) / DATA_PAGE_SIZE] = DATA_PAGE_DIRTY | DATA_PAGE_TOUCHED;
+}
+
+uint32_t System::readInput() {
+    int c;
+    if (replayInput != nullptr) {
+        c = replayInputOffset < replayInput->size() ? (*replayInput)[replayInputOffset++] : EOF;
+    } else {
+        if (perfCounters != nullptr) {
+            perfCounters->enter(PERF_PHASE_MMIO);
+            c = getchar();
+            perfCounters->enter(PERF_PHASE_EXECUTE);
+        } else {
+            c = getchar();
+        }
+        if (sampler != nullptr) {
+            sampler->logInput(c);
+        }
+    }
+
+    if (c != EOF) {
+        mmioBytesIn++;
+    }
+
+    // Once a non-interactive stdin reaches EOF every further read is EOF too, so it changes nothing
+    if (c != EOF || inputIsTerminal) {
+        sideEffect = true;
+    }
+    return static_cast<uint32_t>(c);
+}
+
+void System::writeOutput(uint32_t word) {
+    // The original run already wrote a replay's output
+    if (replayInput == nullptr && perfCounters != nullptr) {
+        perfCounters->enter(PERF_PHASE_MMIO);
+        putchar(word);
+        perfCounters->enter(PERF_PHASE_EXECUTE);
+    } else if (replayInput == nullptr) {
+        putchar(word);
+    }
+    mmioBytesOut++;
+    sideEffect = true;
+}
+
+uint32_t *System::getAmoTarget() {
+    if (amoAddress % WORD_SIZE_IN_BYTES != 0 || amoAddress - ADDR_DATA >= MEMORY_DATA_SIZE) {
+        cerr << "Attempted an atomic operation on an invalid data address " << std::hex << amoAddress << endl;
+        exitProgram(ERROR_CPU_EXCEPTION);
+    }
+    markWritten(amoAddress);
+    sideEffect = true;
+    return reinterpret_cast<uint32_t *>(memoryData.get() + (amoAddress - ADDR_DATA));
+}
+
+// Atomic operations are sequentially consistent, so they also order the relaxed accesses around them
+uint32_t System::atomicSwap() {
+    return toGuestWord(__atomic_exchange_n(getAmoTarget(), toGuestWord(amoOperand), __ATOMIC_SEQ_CST));
+}
+
+uint32_t System::atomicAdd() {
+    uint32_t *target = getAmoTarget();
+    uint32_t expected = __atomic_load_n(target, __ATOMIC_RELAXED);
+    // The word is stored big-endian, so the add cannot use the host's fetch-and-add directly
+    while (!__atomic_compare_exchange_n(target, &expected, toGuestWord(toGuestWord(expected) + amoOperand),
+                                        false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+    return toGuestWord(expected);
+}
+
 uint32_t System::readRegister(uint8_t reg) {
     if (reg < REGISTERS_SIZE) {
         return registers[reg];
     }
     cerr << "Attempted to read an invalid register." << endl;
-    exit(ERROR_INVALID_INSTRUCTION);
+    exitProgram(ERROR_INVALID_INSTRUCTION);
 }
 
 void System::writeRegister(uint8_t reg, uint32_t word) {
     if (reg >= REGISTERS_SIZE) {
         cerr << "Attempted to write to an invalid register " << std::hex << reg << endl;
-        exit(ERROR_INVALID_INSTRUCTION);
+        exitProgram(ERROR_INVALID_INSTRUCTION);
     }
     registers[reg] = word;
 }
@@ -177,34 +576,166 @@ uint8_t System::getExitCode() {
     return static_cast<uint8_t>(readRegister(2) & MASK_BYTE);
 }
 
+uint64_t System::getInstructionCount() {
+    return instructionCount;
+}
+
+uint64_t System::getPublishedInstructionCount() const {
+    return publishedInstructionCount.load(memory_order_relaxed);
+}
+
+void System::setInstructionBudget(uint64_t budget) {
+    instructionBudget = budget;
+    scheduleNextEvent();
+}
+
+void System::setCoverage(Coverage *coverage) {
+    this->coverage = coverage;
+    // Coverage needs every instruction and branch direction recorded
+    if (coverage != nullptr) {
+        loopIdiomsEnabled = false;
+    }
+}
+
+void System::disableLoopIdioms() {
+    loopIdiomsEnabled = false;
+}
+
+void System::setTraceCache(TraceCache *traceCache) {
+    this->traceCache = traceCache;
+}
+
+void System::setSampler(Sampler *sampler) {
+    this->sampler = sampler;
+    saveCheckpoint();
+    scheduleNextEvent();
+}
+
+void System::scheduleNextEvent() {
+    nextEvent = instructionBudget;
+    if (sampler != nullptr) {
+        uint64_t interval = sampler->getInterval();
+        nextEvent = min(nextEvent, (instructionCount / interval + 1) * interval);
+    }
+    if (metrics != nullptr) {
+        nextEvent = min(nextEvent, (instructionCount / METRICS_PUBLISH_INTERVAL + 1) * METRICS_PUBLISH_INTERVAL);
+    }
+    if (hartCount > 1) {
+        nextEvent = min(nextEvent, (instructionCount / INSTRUCTION_COUNT_PUBLISH_INTERVAL + 1) *
+                                   INSTRUCTION_COUNT_PUBLISH_INTERVAL);
+    }
+}
+
+void System::handleEvent() {
+    // Save the checkpoint first, so that the interval before a budget running out can still be replayed
+    if (sampler != nullptr && instructionCount % sampler->getInterval() == 0) {
+        saveCheckpoint();
+    }
+    if (metrics != nullptr && instructionCount % METRICS_PUBLISH_INTERVAL == 0) {
+        publishMetrics();
+    }
+    if (hartCount > 1 && instructionCount % INSTRUCTION_COUNT_PUBLISH_INTERVAL == 0) {
+        publishedInstructionCount.store(instructionCount, memory_order_relaxed);
+    }
+    if (instructionCount == instructionBudget) {
+        exhaustInstructionBudget();
+    }
+    scheduleNextEvent();
+}
+
+void System::saveCheckpoint() {
+    if (!sampler->keepsNextCheckpoint()) {
+        sampler->skipCheckpoint(instructionCount);
+        return;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.instructionCount = instructionCount;
+    checkpoint.pc = pc;
+    checkpoint.nextPC = nextPC;
+    checkpoint.hiLo = hiLo;
+    memcpy(checkpoint.registers, registers, sizeof(registers));
+    checkpoint.amoAddress = amoAddress;
+    checkpoint.amoOperand = amoOperand;
+    checkpoint.inputOffset = sampler->getInputLogSize();
+
+    for (uint32_t page = 0; page < dirtyPages.size(); page++) {
+        if (dirtyPages[page] & DATA_PAGE_DIRTY) {
+            dirtyPages[page] = DATA_PAGE_TOUCHED;
+            checkpoint.pageNumbers.push_back(page);
+            const uint8_t *data = memoryData.get() + page * DATA_PAGE_SIZE;
+            checkpoint.pageData.insert(checkpoint.pageData.end(), data, data + DATA_PAGE_SIZE);
+        }
+    }
+    sampler->addCheckpoint(std::move(checkpoint));
+}
+
+void System::setMetrics(HartMetrics *metrics) {
+    this->metrics = metrics;
+    publishMetrics();
+    scheduleNextEvent();
+}
+
+void System::publishMetrics() {
+    metrics->instructions.store(instructionCount, memory_order_relaxed);
+    metrics->pc.store(pc, memory_order_relaxed);
+    metrics->mmioBytesIn.store(mmioBytesIn, memory_order_relaxed);
+    metrics->mmioBytesOut.store(mmioBytesOut, memory_order_relaxed);
+    metrics->touchedPages.store(static_cast<uint64_t>(count_if(dirtyPages.begin(), dirtyPages.end(),
+                                                               [](uint8_t flags) { return flags != 0; })),
+                                memory_order_relaxed);
+    metrics->loopIdiomsRun.store(loopIdiomsRun, memory_order_relaxed);
+    if (traceCache != nullptr) {
+        metrics->tracesFormed.store(traceCache->getTracesFormed(), memory_order_relaxed);
+        metrics->tracesInvalidated.store(traceCache->getTracesInvalidated(), memory_order_relaxed);
+        metrics->tracesLoaded.store(traceCache->getTracesLoaded(), memory_order_relaxed);
+    }
+}
+
+void System::setPerfCounters(PerfCounters *perfCounters) {
+    this->perfCounters = perfCounters;
+}
+
+void System::restoreCheckpoint(const Checkpoint &checkpoint, const std::vector<int> *inputLog) {
+    instructionCount = checkpoint.instructionCount;
+    pc = checkpoint.pc;
+    nextPC = checkpoint.nextPC;
+    hiLo = checkpoint.hiLo;
+    memcpy(registers, checkpoint.registers, sizeof(registers));
+    amoAddress = checkpoint.amoAddress;
+    amoOperand = checkpoint.amoOperand;
+    replayInput = inputLog;
+    replayInputOffset = checkpoint.inputOffset;
+    scheduleNextEvent();
+}
+
+void System::replay(uint64_t instructions, InstructionMix *mix) {
+    for (uint64_t i = 0; i < instructions && pc != ADDR_NULL; i++) {
+        Instruction instruction = fetch();
+        bool advanced = executeAndAdvance(&instruction, opcodeTable.handlers[instruction.getOpcode()]);
+        mix->record(instruction, !advanced);
+    }
+}
+
+void System::exhaustInstructionBudget() {
+    cerr << "Instruction budget of " << instructionBudget << " instructions exhausted" << endl;
+    exitProgram(ERROR_INTERNAL);
+}
+
 void System::executeRTypeInstruction(Instruction *instruction) {
-    switch (instruction->getFunctionCode()) {
-        case SLL: _sll(instruction); break;
-        case SRL: _srl(instruction); break;
-        case SRA: _sra(instruction); break;
-        case ADD: _add(instruction); break;
-        case ADDU: _addu(instruction); break;
-        case SUB: _sub(instruction); break;
-        case SUBU: _subu(instruction); break;
-        case AND: _and(instruction); break;
-        case OR: _or(instruction); break;
-        case XOR: _xor(instruction); break;
-        case SLT: _slt(instruction); break;
-        case SLTU: _sltu(instruction); break;
-        case JR: _jr(instruction); break;
-        case JALR: _jalr(instruction); break;
-        case DIV: _div(instruction); break;
-        case DIVU: _divu(instruction); break;
-        case MFHI: _mfhi(instruction); break;
-        case MFLO: _mflo(instruction); break;
-        case MTHI: _mthi(instruction); break;
-        case MTLO: _mtlo(instruction); break;
-        case MULT: _mult(instruction); break;
-        case MULTU: _multu(instruction); break;
-        case SLLV: _sllv(instruction); break;
-        case SRAV: _srav(instruction); break;
-        case SRLV: _srlv(instruction); break;
+    (this->*functionCodeTable.handlers[instruction->getFunctionCode()])(instruction);
+}
+
+InstructionHandler System::resolveHandler(Instruction instruction) {
+    if (instruction.getOpcode() == R) {
+        return functionCodeTable.handlers[instruction.getFunctionCode()];
     }
+    return opcodeTable.handlers[instruction.getOpcode()];
+}
+
+void System::_invalid(Instruction *instruction) {
+    cerr << "Attempted to execute an invalid instruction " << std::hex << instruction->getRaw() << endl;
+    exitProgram(ERROR_INVALID_INSTRUCTION);
 }
 
 // R-Type Instructions
@@ -230,12 +761,12 @@ void System::_add(Instruction *instruction) {
     auto s = static_cast<int32_t>(readRegister(instruction->getRegisterS()));
     auto t = static_cast<int32_t>(readRegister(instruction->getRegisterT()));
 
-    if ((t > 0 && s > INT32_MAX - t) ||
-        (t < 0 && s < INT32_MIN - t)) {
-        exit(ERROR_ARITHMETIC);
+    int32_t result;
+    if (__builtin_expect(__builtin_add_overflow(s, t, &result), 0)) {
+        exitProgram(ERROR_ARITHMETIC);
     }
 
-    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(s + t));
+    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(result));
 }
 
 void System::_addu(Instruction *instruction) {
@@ -248,12 +779,12 @@ void System::_sub(Instruction *instruction) {
     auto s = static_cast<int32_t>(readRegister(instruction->getRegisterS()));
     auto t = static_cast<int32_t>(readRegister(instruction->getRegisterT()));
 
-    if ((t < 0 && s > INT32_MAX + t) ||
-        (t > 0 && s < INT32_MIN + t)) {
-        exit(ERROR_ARITHMETIC);
+    int32_t result;
+    if (__builtin_expect(__builtin_sub_overflow(s, t, &result), 0)) {
+        exitProgram(ERROR_ARITHMETIC);
     }
 
-    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(s - t));
+    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(result));
 }
 
 void System::_subu(Instruction *instruction) {
@@ -301,53 +832,60 @@ void System::_jalr(Instruction *instruction) {
 }
 
 void System::_div(Instruction *instruction) {
-    int32_t num = readRegister(instruction->getRegisterS());
-    int32_t denom = readRegister(instruction->getRegisterT());
-    if (denom != 0) {
-        hi = static_cast<uint32_t>(num % denom);
-        lo = static_cast<uint32_t>(num / denom);
+    auto num = static_cast<int32_t>(readRegister(instruction->getRegisterS()));
+    auto denom = static_cast<int32_t>(readRegister(instruction->getRegisterT()));
+    // The result of dividing by zero is unpredictable, so hi and lo are left unchanged
+    if (__builtin_expect(denom == 0, 0)) {
+        return;
+    }
+    // INT32_MIN / -1 overflows, which traps on the host but gives INT32_MIN remainder 0 on MIPS
+    if (__builtin_expect(denom == -1, 0)) {
+        setHiLo(0, 0 - static_cast<uint32_t>(num));
+        return;
     }
+    setHiLo(static_cast<uint32_t>(num % denom), static_cast<uint32_t>(num / denom));
 }
 
 void System::_divu(Instruction *instruction) {
     uint32_t num = readRegister(instruction->getRegisterS());
     uint32_t denom = readRegister(instruction->getRegisterT());
-    if (denom != 0) {
-        hi = num % denom;
-        lo = num / denom;
+    if (__builtin_expect(denom == 0, 0)) {
+        return;
     }
+    setHiLo(num % denom, num / denom);
 }
 
 void System::_mfhi(Instruction *instruction) {
-    writeRegister(instruction->getRegisterD(), hi);
+    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(hiLo >> 32));
 }
 
 void System::_mflo(Instruction *instruction) {
-    writeRegister(instruction->getRegisterD(), lo);
+    writeRegister(instruction->getRegisterD(), static_cast<uint32_t>(hiLo));
 }
 
 void System::_mthi(Instruction *instruction) {
     uint32_t word = readRegister(instruction->getRegisterS());
-    hi = word;
+    setHiLo(word, static_cast<uint32_t>(hiLo));
 }
 
 void System::_mtlo(Instruction *instruction) {
     uint32_t word = readRegister(instruction->getRegisterS());
-    lo = word;
+    setHiLo(static_cast<uint32_t>(hiLo >> 32), word);
 }
 
 void System::_mult(Instruction *instruction) {
     int64_t result = static_cast<int64_t>(static_cast<int32_t>(readRegister(instruction->getRegisterS()))) *
                      static_cast<int64_t>(static_cast<int32_t>(readRegister(instruction->getRegisterT())));
-    hi = static_cast<uint32_t>(result >> 32);
-    lo = static_cast<uint32_t>(result);
+    hiLo = static_cast<uint64_t>(result);
 }
 
 void System::_multu(Instruction *instruction) {
-    uint64_t result = static_cast<uint64_t>(readRegister(instruction->getRegisterS())) *
-                      static_cast<uint64_t>(readRegister(instruction->getRegisterT()));
-    hi = static_cast<uint32_t>(result >> 32);
-    lo = static_cast<uint32_t>(result);
+    hiLo = static_cast<uint64_t>(readRegister(instruction->getRegisterS())) *
+           static_cast<uint64_t>(readRegister(instruction->getRegisterT()));
+}
+
+void System::setHiLo(uint32_t hi, uint32_t lo) {
+    hiLo = (static_cast<uint64_t>(hi) << 32) | lo;
 }
 
 void System::_addiu(Instruction *instruction) {
@@ -392,29 +930,23 @@ void System::_lui(Instruction *instruction) {
 }
 
 void System::_beq(Instruction *instruction) {
-    if (readRegister(instruction->getRegisterS()) ==
-        readRegister(instruction->getRegisterT())) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(readRegister(instruction->getRegisterS()) ==
+             readRegister(instruction->getRegisterT()),
+             instruction);
 }
 
 void System::_bne(Instruction *instruction) {
-    if (readRegister(instruction->getRegisterS()) !=
-        readRegister(instruction->getRegisterT())) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(readRegister(instruction->getRegisterS()) !=
+             readRegister(instruction->getRegisterT()),
+             instruction);
 }
 
 void System::_blez(Instruction *instruction) {
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) <= 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) <= 0, instruction);
 }
 
 void System::_bgtz(Instruction *instruction) {
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) > 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) > 0, instruction);
 }
 
 void System::_b_spec(Instruction *instruction) {
@@ -423,6 +955,7 @@ void System::_b_spec(Instruction *instruction) {
         case BGEZAL: _bgezal(instruction); break;
         case BLTZ: _bltz(instruction); break;
         case BLTZAL: _bltzal(instruction); break;
+        default: _invalid(instruction); break;
     }
 }
 
@@ -466,12 +999,12 @@ void System::_addi(Instruction *instruction) {
     auto s = static_cast<int32_t>(readRegister(instruction->getRegisterS()));
     auto imm = static_cast<int16_t>(instruction->getImmediateOperand());
 
-    if ((imm > 0 && s > INT32_MAX - imm) ||
-        (imm < 0 && s < INT32_MIN - imm)) {
-        exit(ERROR_ARITHMETIC);
+    int32_t result;
+    if (__builtin_expect(__builtin_add_overflow(s, static_cast<int32_t>(imm), &result), 0)) {
+        exitProgram(ERROR_ARITHMETIC);
     }
 
-    writeRegister(instruction->getRegisterT(), static_cast<uint32_t>(s + imm));
+    writeRegister(instruction->getRegisterT(), static_cast<uint32_t>(result));
 }
 
 void System::_lbu(Instruction *instruction) {
@@ -531,7 +1064,11 @@ void System::_srlv(Instruction *instruction) {
 }
 
 void System::_j(Instruction *instruction) {
-    setPC((pc & 0xF0000000) | (instruction->getJumpAddress() << 2));
+    uint32_t address = (pc & 0xF0000000) | (instruction->getJumpAddress() << 2);
+    setPC(address);
+    if (address < pc) {
+        checkIdleLoop();
+    }
 }
 
 void System::_jal(Instruction *instruction) {
@@ -549,29 +1086,90 @@ void System::incrementPC(uint32_t offset) {
     setPC(nextPC + static_cast<int32_t>(offset));
 }
 
+void System::branchIf(bool condition, Instruction *instruction) {
+    if (coverage != nullptr) {
+        coverage->recordBranch((pc - ADDR_INSTR) / WORD_SIZE_IN_BYTES, condition);
+    }
+    auto offset = static_cast<int32_t>(static_cast<int16_t>(instruction->getImmediateOperand())) << 2;
+    if (condition && offset < 0 && loopIdiomsEnabled) {
+        const LoopIdiom *idiom = program->getLoopIdiom(pc - ADDR_INSTR);
+        if (idiom != nullptr && idiom != rejectedIdiom) {
+            pendingIdiom = idiom;
+        }
+    }
+    if (traceCache != nullptr) {
+        Trace *trace = traceCache->recordBranch(pc, nextPC + offset, condition);
+        if (trace != nullptr) {
+            pendingTrace = trace;
+        }
+    }
+    if (condition) {
+        incrementPC(static_cast<uint32_t>(offset));
+        if (offset < 0) {
+            checkIdleLoop();
+        }
+    }
+}
+
+void System::checkIdleLoop() {
+    // Other harts can change shared memory, so a loop is never provably idle with more than one.
+    // A replay only runs instructions the original run finished, so it cannot be stuck either.
+    if (hartCount > 1 || replayInput != nullptr) {
+        return;
+    }
+
+    // Called after a backward branch is taken, so pc is its delay slot and nextPC the loop head
+    if (pc != idleLoopPC || sideEffect) {
+        idleLoopPC = pc;
+        idleLoopRepeats = 0;
+        sideEffect = false;
+        return;
+    }
+
+    // Only compare machine state every few iterations, to keep ordinary loops cheap
+    if (++idleLoopRepeats % IDLE_LOOP_CHECK_INTERVAL != 0) {
+        return;
+    }
+
+    if (idleLoopRepeats > IDLE_LOOP_CHECK_INTERVAL && hiLo == idleSnapshotHiLo &&
+        memcmp(registers, idleSnapshotRegisters, sizeof(registers)) == 0) {
+        idleLoop();
+    }
+
+    idleSnapshotHiLo = hiLo;
+    memcpy(idleSnapshotRegisters, registers, sizeof(registers));
+}
+
+void System::idleLoop() {
+    if (instructionBudget != NO_INSTRUCTION_BUDGET) {
+        // Every remaining instruction is another iteration of the loop, so skip to the end of the budget
+        cerr << "Idle loop detected at " << std::hex << nextPC << std::dec << endl;
+        instructionCount = instructionBudget;
+        exhaustInstructionBudget();
+    }
+
+    // The guest can never finish, so wait to be killed instead of spinning
+    fflush(stdout);
+    for (;;) {
+        pause();
+    }
+}
+
 // Special B-Type functions
 void System::_bgezal(Instruction *instruction) {
     writeRegister(31, nextPC + WORD_SIZE_IN_BYTES);
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) >= 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) >= 0, instruction);
 }
 
 void System::_bgez(Instruction *instruction) {
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) >= 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) >= 0, instruction);
 }
 
 void System::_bltz(Instruction *instruction) {
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) < 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) < 0, instruction);
 }
 
 void System::_bltzal(Instruction *instruction) {
     writeRegister(31, nextPC + WORD_SIZE_IN_BYTES);
-    if (static_cast<int32_t>(readRegister(instruction->getRegisterS())) < 0) {
-        incrementPC(static_cast<uint32_t>(static_cast<int16_t>(instruction->getImmediateOperand()) << 2));
-    }
+    branchIf(static_cast<int32_t>(readRegister(instruction->getRegisterS())) < 0, instruction);
 }
@@ -1,6 +1,12 @@
+#include <atomic>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <memory>
+#include <vector>
 #include "Instruction.h"
+#include "Coverage.h"
+#include "Program.h"
 
 using namespace std;
 
@@ -9,6 +15,14 @@ using namespace std;
 
 #define MEMORY_INSTR_SIZE 0x1000000
 #define MEMORY_DATA_SIZE 0x4000000
+#define DATA_PAGE_SIZE 0x1000
+
+// With more than one hart, each publishes its instruction count for other threads this often
+#define INSTRUCTION_COUNT_PUBLISH_INTERVAL (1 << 16)
+
+// Flags in System::dirtyPages
+#define DATA_PAGE_DIRTY 1
+#define DATA_PAGE_TOUCHED 2
 #define REGISTERS_SIZE 32
 
 #define ADDR_NULL 0x0
@@ -16,21 +30,154 @@ using namespace std;
 #define ADDR_DATA 0x20000000
 #define ADDR_GETC 0x30000000
 #define ADDR_PUTC 0x30000004
+#define ADDR_HART_ID 0x30000008
+#define ADDR_HART_COUNT 0x3000000C
+
+// Atomic MMIO: write the target data address and the operand, then read SWAP or ADD to atomically
+// exchange with or add the operand to the target word, returning its old value
+#define ADDR_AMO_ADDRESS 0x30000010
+#define ADDR_AMO_OPERAND 0x30000014
+#define ADDR_AMO_SWAP 0x30000018
+#define ADDR_AMO_ADD 0x3000001C
+
+#define MAX_HARTS 256
+
+#define NO_INSTRUCTION_BUDGET UINT64_MAX
+
+// Number of iterations of the same backward branch between idle loop state comparisons
+#define IDLE_LOOP_CHECK_INTERVAL 64
+
+class System;
+class TraceCache;
+struct Trace;
+class Sampler;
+struct Checkpoint;
+struct InstructionMix;
+struct HartMetrics;
+class PerfCounters;
+
+// Pointer to a handler that executes a single decoded instruction
+typedef void (System::*InstructionHandler)(Instruction *instruction);
+
+template <size_t size>
+struct HandlerTable {
+    InstructionHandler handlers[size];
+};
+typedef HandlerTable<OPCODE_TABLE_SIZE> OpcodeTable;
+typedef HandlerTable<FUNCTION_CODE_TABLE_SIZE> FunctionCodeTable;
 
+// Releases memory allocated with calloc
+struct FreeDeleter {
+    void operator()(void *memory) const {
+        free(memory);
+    }
+};
+
+// The mutable state of one run (or one hart): registers, hi/lo, PC and data memory. The program it
+// executes is a shared, immutable Program, so several Systems can run the same binary without copying
+// it. Harts of a multi-core guest also share their data memory (see multicore.md).
 class System {
 private:
     uint32_t pc = ADDR_INSTR;
     uint32_t nextPC = ADDR_INSTR + WORD_SIZE_IN_BYTES;
     bool updatePC = true;
+    uint64_t instructionCount = 0;
+    // instructionCount as last published, the only copy other threads may read
+    std::atomic<uint64_t> publishedInstructionCount{0};
+    Coverage *coverage = nullptr;
+    TraceCache *traceCache = nullptr;
+    // Set by a hot backward branch, and entered once its delay slot has executed and pc reaches the trace
+    Trace *pendingTrace = nullptr;
+
+    // Likewise for a loop that the Program recognised as a memory idiom. A loop whose last attempt was
+    // out of bounds or overlapping is not tried again until another idiom has run.
+    bool loopIdiomsEnabled;
+    const LoopIdiom *pendingIdiom = nullptr;
+    const LoopIdiom *rejectedIdiom = nullptr;
+    uint64_t instructionBudget = NO_INSTRUCTION_BUDGET;
+    Sampler *sampler = nullptr;
+
+    // The next instruction count at which something other than executing has to happen: the budget
+    // running out or a checkpoint being due. The hot loop only compares against this one count.
+    uint64_t nextEvent = NO_INSTRUCTION_BUDGET;
+
+    // When replaying from a checkpoint, stdin comes from the log of the original run and output is dropped
+    const std::vector<int> *replayInput = nullptr;
+    uint64_t replayInputOffset = 0;
 
-    uint32_t hi = 0;
-    uint32_t lo = 0;
+    // Idle loop detection: if the machine is in the same state at the same backward branch
+    // twice with no side effects in between, the guest will loop there forever
+    uint32_t idleLoopPC = ADDR_NULL;
+    uint32_t idleLoopRepeats = 0;
+    bool sideEffect = false;
+    bool inputIsTerminal;
+    uint64_t idleSnapshotHiLo = 0;
+    uint32_t idleSnapshotRegisters[REGISTERS_SIZE] = {0};
+
+    // hi and lo are stored together as the 64-bit result of the last multiply or divide,
+    // and only split into the two registers when mfhi or mflo reads them
+    uint64_t hiLo = 0;
     uint32_t registers[REGISTERS_SIZE] = {0};
-    uint8_t memoryInstr[MEMORY_INSTR_SIZE] = {0};
-    uint8_t memoryData[MEMORY_DATA_SIZE] = {0};
+    std::shared_ptr<const Program> program;
+
+    // Data memory may be shared with other harts, so it is only accessed through relaxed atomics
+    std::shared_ptr<uint8_t> memoryData;
+
+    // One byte of flags per data page: written since the last checkpoint, and written at all
+    std::vector<uint8_t> dirtyPages;
+
+    // Published to metrics, if set, whenever the instruction count reaches a multiple of METRICS_PUBLISH_INTERVAL
+    HartMetrics *metrics = nullptr;
+    uint64_t mmioBytesIn = 0;
+    uint64_t mmioBytesOut = 0;
+    uint64_t loopIdiomsRun = 0;
+
+    // Host counters to switch to PERF_PHASE_MMIO around stdin and stdout
+    PerfCounters *perfCounters = nullptr;
 
+    uint32_t hartId;
+    uint32_t hartCount;
+    uint32_t amoAddress = 0;
+    uint32_t amoOperand = 0;
+
+    // Decode tables indexed by opcode and by R-Type function code, generated at compile time
+    static const OpcodeTable opcodeTable;
+    static const FunctionCodeTable functionCodeTable;
+    static constexpr OpcodeTable makeOpcodeTable();
+    static constexpr FunctionCodeTable makeFunctionCodeTable();
+
+    // Execute the instruction at pc, or a predecoded one with its handler, and advance the PC;
+    // both return false if the instruction set the PC itself
+    Instruction fetch();
+    bool step();
+    bool executeAndAdvance(Instruction *instruction, InstructionHandler handler);
+    void enterLoop();
+    void runTrace(Trace *trace);
+    bool runLoopIdiom(const LoopIdiom *idiom);
+    void scheduleNextEvent();
+    void handleEvent();
+    void saveCheckpoint();
+    void markWritten(uint32_t address);
+    void setHiLo(uint32_t hi, uint32_t lo);
     void setPC(uint32_t address);
     void incrementPC(uint32_t offset);
+    void branchIf(bool condition, Instruction *instruction);
+    void checkIdleLoop();
+    void idleLoop();
+    void exhaustInstructionBudget();
+
+    // Ends the whole program; only the first hart to call it runs exit() and the atexit handlers
+    [[noreturn]] void exitProgram(int exitCode);
+
+    // MMIO
+    uint32_t readInput();
+    void writeOutput(uint32_t word);
+    uint32_t *getAmoTarget();
+    uint32_t atomicSwap();
+    uint32_t atomicAdd();
+
+    // Trap for any encoding that does not map to a supported instruction
+    void _invalid(Instruction *instruction);
 
     // I-Type functions
     void _addiu(Instruction *instruction);
@@ -93,12 +240,20 @@ private:
     void _bltzal(Instruction *instruction);
 
 public:
-    System(){};
+    explicit System(std::shared_ptr<const Program> program,
+                    std::shared_ptr<uint8_t> memoryData = allocateDataMemory(),
+                    uint32_t hartId = 0, uint32_t hartCount = 1);
+
+    // calloc leaves untouched pages unmapped, so unused data memory costs neither time nor RSS
+    static std::shared_ptr<uint8_t> allocateDataMemory();
+
     void start();
-    void loadInstructionsFromStream(ifstream *stream);
     void executeInstruction(Instruction *instruction);
     void executeRTypeInstruction(Instruction *instruction);
 
+    // The handler for an instruction, looking through the R-Type function code table
+    static InstructionHandler resolveHandler(Instruction instruction);
+
     // Memory
     uint32_t readMemoryWord(uint32_t address);
     uint16_t readMemoryHalfWord(uint32_t address);
@@ -113,6 +268,44 @@ public:
 
     // Get lower 8 bits of $2 register
     uint8_t getExitCode();
+
+    // Number of guest instructions executed so far; only the thread running this System may call it
+    uint64_t getInstructionCount();
+
+    // The count as of this System stopping, exiting the program or, with more than one hart, the last multiple
+    // of INSTRUCTION_COUNT_PUBLISH_INTERVAL; any thread may call it
+    uint64_t getPublishedInstructionCount() const;
+
+    // Stop the guest with ERROR_INTERNAL once this many instructions have executed
+    void setInstructionBudget(uint64_t budget);
+
+    // Record executed instructions and branch directions into coverage
+    void setCoverage(Coverage *coverage);
+
+    // Run recognised copy, fill and scan loops one instruction at a time, as the guest wrote them
+    void disableLoopIdioms();
+
+    // Profile branches and run hot loops as traces
+    void setTraceCache(TraceCache *traceCache);
+
+    // Save a checkpoint into the sampler at every multiple of its interval, and log stdin for replay
+    void setSampler(Sampler *sampler);
+
+    // Publish counters to metrics now and then every METRICS_PUBLISH_INTERVAL instructions. Only the
+    // thread running this System may call publishMetrics.
+    void setMetrics(HartMetrics *metrics);
+    void publishMetrics();
+
+    // Attribute host counters spent on stdin and stdout to PERF_PHASE_MMIO. The counters must belong to the
+    // thread running this System.
+    void setPerfCounters(PerfCounters *perfCounters);
+
+    // Continue from a checkpoint of another run, whose data memory has already been restored,
+    // reading stdin from that run's input log
+    void restoreCheckpoint(const Checkpoint &checkpoint, const std::vector<int> *inputLog);
+
+    // Execute up to the given number of instructions, recording each into the mix
+    void replay(uint64_t instructions, InstructionMix *mix);
 };
 
 
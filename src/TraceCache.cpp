@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "TraceCache.h"
+
+using namespace std;
+
+TraceCache::TraceCache(shared_ptr<const Program> program) :
+        program(program),
+        profiles((program->getSize() + WORD_SIZE_IN_BYTES - 1) / WORD_SIZE_IN_BYTES),
+        traces(profiles.size()) {}
+
+Trace *TraceCache::recordBranch(uint32_t address, uint32_t target, bool taken) {
+    uint32_t index = (address - ADDR_INSTR) / WORD_SIZE_IN_BYTES;
+    if (index >= profiles.size()) {
+        return nullptr;
+    }
+
+    BranchProfile &profile = profiles[index];
+    if (profile.taken == TRACE_PROFILE_MAX_COUNT || profile.notTaken == TRACE_PROFILE_MAX_COUNT) {
+        profile.taken /= 2;
+        profile.notTaken /= 2;
+    }
+    if (!taken) {
+        profile.notTaken++;
+        return nullptr;
+    }
+    profile.taken++;
+
+    uint32_t targetIndex = (target - ADDR_INSTR) / WORD_SIZE_IN_BYTES;
+    if (target > address || targetIndex >= traces.size()) {
+        return nullptr;
+    }
+    if (traces[targetIndex] != nullptr) {
+        return traces[targetIndex].get();
+    }
+    if (profile.taken >= TRACE_HOT_THRESHOLD) {
+        tracesFormed.fetch_add(1, memory_order_relaxed);
+        return form(target);
+    }
+    return nullptr;
+}
+
+static bool isConditionalBranch(Instruction instruction) {
+    switch (instruction.getOpcode()) {
+        case BEQ:
+        case BNE:
+        case BLEZ:
+        case BGTZ:
+            return true;
+        case B_SPEC:
+            switch (instruction.getBCode()) {
+                case BGEZ:
+                case BGEZAL:
+                case BLTZ:
+                case BLTZAL:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+static bool isJump(Instruction instruction) {
+    InstructionOpcode opcode = instruction.getOpcode();
+    if (opcode == J || opcode == JAL) {
+        return true;
+    }
+    return opcode == R && (instruction.getFunctionCode() == JR || instruction.getFunctionCode() == JALR);
+}
+
+Trace *TraceCache::form(uint32_t entry) {
+    auto trace = unique_ptr<Trace>(new Trace());
+    trace->entry = entry;
+
+    uint32_t address = entry;
+    while (trace->ops.size() + 1 < TRACE_MAX_LENGTH && address - ADDR_INSTR < program->getSize()) {
+        Instruction instruction = program->getInstruction(address - ADDR_INSTR);
+        trace->ops.push_back({instruction, System::resolveHandler(instruction), address});
+
+        bool branch = isConditionalBranch(instruction);
+        if (!branch && !isJump(instruction)) {
+            address += WORD_SIZE_IN_BYTES;
+            if (address == entry) {
+                break;
+            }
+            continue;
+        }
+
+        // Branches and jumps always take their delay slot with them; a branch in a delay slot ends the trace
+        uint32_t delaySlot = address + WORD_SIZE_IN_BYTES;
+        Instruction delayed = program->getInstruction(delaySlot - ADDR_INSTR);
+        if (isConditionalBranch(delayed) || isJump(delayed)) {
+            break;
+        }
+        trace->ops.push_back({delayed, System::resolveHandler(delayed), delaySlot});
+
+        InstructionOpcode opcode = instruction.getOpcode();
+        if (branch) {
+            uint32_t index = (address - ADDR_INSTR) / WORD_SIZE_IN_BYTES;
+            const BranchProfile &profile = profiles[index];
+            trace->branches.push_back(index);
+            if (profile.taken >= profile.notTaken) {
+                address = delaySlot + (static_cast<int32_t>(static_cast<int16_t>(instruction.getImmediateOperand())) << 2);
+            } else {
+                address = delaySlot + WORD_SIZE_IN_BYTES;
+            }
+        } else if (opcode == J || opcode == JAL) {
+            address = (delaySlot & 0xF0000000) | (instruction.getJumpAddress() << 2);
+        } else {
+            // The target of a register jump is unknown
+            break;
+        }
+
+        if (address == entry) {
+            break;
+        }
+    }
+
+    Trace *formed = trace.get();
+    traces[(entry - ADDR_INSTR) / WORD_SIZE_IN_BYTES] = move(trace);
+    return formed;
+}
+
+void TraceCache::recordExit(Trace *trace, uint64_t iterations, bool sideExit) {
+    trace->iterations += iterations;
+    if (!sideExit) {
+        return;
+    }
+    trace->sideExits++;
+
+    // Counting per iteration rather than per entry keeps a loop whose cold branch is taken now and then,
+    // which would only form the same trace again
+    if (trace->iterations < TRACE_MIN_ITERATIONS_BEFORE_INVALIDATION || trace->sideExits * 2 <= trace->iterations) {
+        if (trace->iterations >= TRACE_EXIT_WINDOW) {
+            trace->iterations /= 2;
+            trace->sideExits /= 2;
+        }
+        return;
+    }
+
+    // The profile has changed, so forget what was learnt about the trace's branches and form it again later
+    for (uint32_t index : trace->branches) {
+        profiles[index] = BranchProfile();
+    }
+    tracesInvalidated.fetch_add(1, memory_order_relaxed);
+    traces[(trace->entry - ADDR_INSTR) / WORD_SIZE_IN_BYTES].reset();
+}
+
+uint64_t TraceCache::getTracesFormed() const {
+    return tracesFormed.load(memory_order_relaxed);
+}
+
+uint64_t TraceCache::getTracesInvalidated() const {
+    return tracesInvalidated.load(memory_order_relaxed);
+}
+
+uint64_t TraceCache::getTracesLoaded() const {
+    return tracesLoaded.load(memory_order_relaxed);
+}
+
+// Files are read back by mapping them, so the layout is the host's; byteOrder rejects files from other hosts
+struct TraceCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t programHash;
+    uint32_t words;
+    uint32_t traceCount;
+};
+
+// Followed by words BranchProfiles, then traceCount word indices of trace entries
+#define TRACE_CACHE_BYTE_ORDER 0x01020304
+
+void TraceCache::loadFromFile(const char *path) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return;
+    }
+    struct stat status = {};
+    if (fstat(file, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(TraceCacheHeader)) {
+        close(file);
+        return;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+
+    const auto *header = static_cast<const TraceCacheHeader *>(mapping);
+    bool valid = memcmp(header->magic, TRACE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == TRACE_CACHE_VERSION && header->byteOrder == TRACE_CACHE_BYTE_ORDER &&
+                 header->programHash == program->getHash() && header->words == profiles.size() &&
+                 size == sizeof(TraceCacheHeader) + header->words * sizeof(BranchProfile) +
+                         header->traceCount * sizeof(uint32_t);
+
+    if (valid) {
+        const auto *savedProfiles = reinterpret_cast<const BranchProfile *>(header + 1);
+        const auto *entries = reinterpret_cast<const uint32_t *>(savedProfiles + header->words);
+        copy(savedProfiles, savedProfiles + header->words, profiles.begin());
+        for (uint32_t i = 0; i < header->traceCount; i++) {
+            if (entries[i] < traces.size() && traces[entries[i]] == nullptr) {
+                form(ADDR_INSTR + entries[i] * WORD_SIZE_IN_BYTES);
+                tracesLoaded.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+    munmap(mapping, size);
+}
+
+void TraceCache::saveToFile(const char *path) const {
+    TraceCacheHeader header = {};
+    memcpy(header.magic, TRACE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_CACHE_VERSION;
+    header.byteOrder = TRACE_CACHE_BYTE_ORDER;
+    header.programHash = program->getHash();
+    header.words = static_cast<uint32_t>(profiles.size());
+
+    vector<BranchProfile> savedProfiles(profiles);
+    for (BranchProfile &profile : savedProfiles) {
+        while (profile.taken > TRACE_CACHE_MAX_COUNT || profile.notTaken > TRACE_CACHE_MAX_COUNT) {
+            profile.taken /= 2;
+            profile.notTaken /= 2;
+        }
+    }
+    vector<uint32_t> entries;
+    for (uint32_t index = 0; index < traces.size(); index++) {
+        if (traces[index] != nullptr) {
+            entries.push_back(index);
+        }
+    }
+    header.traceCount = static_cast<uint32_t>(entries.size());
+
+    string temporaryPath = string(path) + ".XXXXXX";
+    int file = mkstemp(&temporaryPath[0]);
+    if (file < 0) {
+        return;
+    }
+    FILE *stream = fdopen(file, "wb");
+    bool written = stream != nullptr &&
+                   fwrite(&header, sizeof(header), 1, stream) == 1 &&
+                   fwrite(savedProfiles.data(), sizeof(BranchProfile), savedProfiles.size(), stream) == savedProfiles.size() &&
+                   fwrite(entries.data(), sizeof(uint32_t), entries.size(), stream) == entries.size();
+    written = (stream != nullptr ? fclose(stream) == 0 : close(file) == 0) && written;
+
+    // mkstemp creates the file readable only by its owner
+    if (!written || chmod(temporaryPath.c_str(), 0644) != 0 || rename(temporaryPath.c_str(), path) != 0) {
+        unlink(temporaryPath.c_str());
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef TRACE_CACHE_H
+#define TRACE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Instruction.h"
+#include "Program.h"
+#include "System.h"
+
+// Times a backward branch must be taken before a trace is formed at its target
+#define TRACE_HOT_THRESHOLD 64
+#define TRACE_MAX_LENGTH 256
+
+// Bump whenever trace formation or the file layout changes, so that old cache files are ignored
+#define TRACE_CACHE_VERSION 1
+#define TRACE_CACHE_MAGIC "MIPSTRC1"
+
+// Profile counts are halved together when either reaches this, so a long-running loop branch never wraps
+// and keeps its direction
+#define TRACE_PROFILE_MAX_COUNT (1U << 31)
+
+// Profile counts are halved before saving once they pass this, so they never overflow across runs
+#define TRACE_CACHE_MAX_COUNT (1U << 30)
+
+// A trace that side-exits on more than half of its loop iterations no longer matches the profile and is
+// reformed. Counts are halved once they pass the window, so an old phase of the run is soon outweighed.
+#define TRACE_MIN_ITERATIONS_BEFORE_INVALIDATION 64
+#define TRACE_EXIT_WINDOW 1024
+
+struct TraceOp {
+    Instruction instruction;
+    InstructionHandler handler;
+    uint32_t address;
+};
+
+// A superblock: the instructions along the hot path from a loop head, following the more frequent
+// direction of each conditional branch. Executing it only needs a check that each instruction is the
+// one the PC actually reached; any other PC is a side exit back to the interpreter.
+struct Trace {
+    uint32_t entry;
+    std::vector<TraceOp> ops;
+    // Profile indices of the conditional branches along the trace
+    std::vector<uint32_t> branches;
+    uint64_t iterations = 0;
+    uint64_t sideExits = 0;
+};
+
+struct BranchProfile {
+    uint32_t taken = 0;
+    uint32_t notTaken = 0;
+};
+
+// Branch profiles and the traces formed from them for one System. Both depend on the run, so unlike
+// the Program they are not shared between Systems.
+class TraceCache {
+private:
+    std::shared_ptr<const Program> program;
+    std::vector<BranchProfile> profiles;
+    std::vector<std::unique_ptr<Trace>> traces;
+
+    // Read at exit from whichever thread exits, while the hart may still be running
+    std::atomic<uint64_t> tracesFormed{0};
+    std::atomic<uint64_t> tracesInvalidated{0};
+    std::atomic<uint64_t> tracesLoaded{0};
+
+    Trace *form(uint32_t entry);
+
+public:
+    explicit TraceCache(std::shared_ptr<const Program> program);
+
+    // Records a conditional branch, returning the trace at its target if it is a hot backward branch
+    Trace *recordBranch(uint32_t address, uint32_t target, bool taken);
+
+    // Records leaving a trace after running the given number of loop iterations in it, including a partial
+    // last one. The trace may be invalidated and deleted.
+    void recordExit(Trace *trace, uint64_t iterations, bool sideExit);
+
+    uint64_t getTracesFormed() const;
+    uint64_t getTracesInvalidated() const;
+    uint64_t getTracesLoaded() const;
+
+    // Seed the profiles from a file written by saveToFile for the same program, and form its traces
+    // up front. A missing, truncated or mismatched file is ignored.
+    void loadFromFile(const char *path);
+
+    // Write the profiles and trace entries. The file is written under a temporary name and renamed
+    // into place, so concurrent writers and readers only ever see a complete file. Only the thread
+    // running the System that uses this cache may call it.
+    void saveToFile(const char *path) const;
+};
+
+#endif
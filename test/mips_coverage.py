@@ -0,0 +1,118 @@
+import struct
+import sys
+
+# Merges coverage files written by the simulator's --coverage option and summarises them.
+# Usage: python test/mips_coverage.py <merged-output.cov> <input.cov>...
+#
+# A coverage file is a sequence of records, one per program image:
+#   "MIPSCOV1", program hash (u64), words (u32), opcodes (u64), function codes (u64), REGIMM codes (u32),
+#   then executed, branch taken and branch not taken bitmaps of ceil(words / 8) bytes each.
+# All integers are little-endian.
+
+MAGIC = b'MIPSCOV1'
+HEADER = struct.Struct('<8sQIQQI')
+
+OPCODES = {
+    0b000000: 'R', 0b001001: 'ADDIU', 0b001010: 'SLTI', 0b001011: 'SLTIU', 0b001100: 'ANDI', 0b001101: 'ORI',
+    0b001110: 'XORI', 0b001111: 'LUI', 0b000100: 'BEQ', 0b000101: 'BNE', 0b000110: 'BLEZ', 0b000111: 'BGTZ',
+    0b000001: 'B_SPEC', 0b100000: 'LB', 0b100001: 'LH', 0b100100: 'LBU', 0b100011: 'LW', 0b101000: 'SB',
+    0b101001: 'SH', 0b101011: 'SW', 0b001000: 'ADDI', 0b100101: 'LHU', 0b100010: 'LWL', 0b100110: 'LWR',
+    0b000010: 'J', 0b000011: 'JAL',
+}
+FUNCTION_CODES = {
+    0b000000: 'SLL', 0b000010: 'SRL', 0b000011: 'SRA', 0b100000: 'ADD', 0b100001: 'ADDU', 0b100010: 'SUB',
+    0b100011: 'SUBU', 0b100100: 'AND', 0b100101: 'OR', 0b100110: 'XOR', 0b101010: 'SLT', 0b101011: 'SLTU',
+    0b001000: 'JR', 0b001001: 'JALR', 0b011010: 'DIV', 0b011011: 'DIVU', 0b010000: 'MFHI', 0b010010: 'MFLO',
+    0b010001: 'MTHI', 0b010011: 'MTLO', 0b011000: 'MULT', 0b011001: 'MULTU', 0b000100: 'SLLV', 0b000111: 'SRAV',
+    0b000110: 'SRLV',
+}
+B_CODES = {0b00001: 'BGEZ', 0b10001: 'BGEZAL', 0b00000: 'BLTZ', 0b10000: 'BLTZAL'}
+
+
+def readRecords(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    offset = 0
+    while offset < len(data):
+        magic, programHash, words, opcodes, functionCodes, bCodes = HEADER.unpack_from(data, offset)
+        if magic != MAGIC:
+            raise ValueError('{} is not a coverage file'.format(path))
+        offset += HEADER.size
+        size = (words + 7) // 8
+        bitmaps = [bytearray(data[offset + i * size:offset + (i + 1) * size]) for i in range(3)]
+        offset += 3 * size
+        yield programHash, words, opcodes, functionCodes, bCodes, bitmaps
+
+
+def orInto(target, source):
+    # Bitmaps from runs that executed past the end of the program can be longer
+    if len(source) > len(target):
+        target.extend(bytearray(len(source) - len(target)))
+    for i in range(len(source)):
+        target[i] |= source[i]
+
+
+def countBits(bitmap):
+    return sum(bin(byte).count('1') for byte in bitmap)
+
+
+def merge(paths):
+    images = {}
+    for path in paths:
+        for programHash, words, opcodes, functionCodes, bCodes, bitmaps in readRecords(path):
+            if programHash not in images:
+                images[programHash] = [words, opcodes, functionCodes, bCodes, bitmaps]
+                continue
+            image = images[programHash]
+            image[0] = max(image[0], words)
+            image[1] |= opcodes
+            image[2] |= functionCodes
+            image[3] |= bCodes
+            for target, source in zip(image[4], bitmaps):
+                orInto(target, source)
+    return images
+
+
+def write(path, images):
+    with open(path, 'wb') as f:
+        for programHash in sorted(images):
+            words, opcodes, functionCodes, bCodes, bitmaps = images[programHash]
+            size = (words + 7) // 8
+            f.write(HEADER.pack(MAGIC, programHash, words, opcodes, functionCodes, bCodes))
+            for bitmap in bitmaps:
+                f.write(bytes(bitmap[:size].ljust(size, b'\0')))
+
+
+def describe(mask, names):
+    hit = [name for code, name in sorted(names.items()) if mask & (1 << code)]
+    missed = [name for code, name in sorted(names.items()) if not mask & (1 << code)]
+    return '{}/{} hit, missed: {}'.format(len(hit), len(names), ' '.join(missed) if missed else 'none')
+
+
+def summarise(images, out):
+    opcodes = functionCodes = bCodes = 0
+    executedWords = totalWords = branches = bothDirections = 0
+    for words, imageOpcodes, imageFunctionCodes, imageBCodes, bitmaps in images.values():
+        opcodes |= imageOpcodes
+        functionCodes |= imageFunctionCodes
+        bCodes |= imageBCodes
+        executed, taken, notTaken = bitmaps
+        executedWords += countBits(executed)
+        totalWords += words
+        branches += countBits(bytearray(a | b for a, b in zip(taken, notTaken)))
+        bothDirections += countBits(bytearray(a & b for a, b in zip(taken, notTaken)))
+
+    out.write('Opcodes: {}\n'.format(describe(opcodes, OPCODES)))
+    out.write('Function codes: {}\n'.format(describe(functionCodes, FUNCTION_CODES)))
+    out.write('REGIMM codes: {}\n'.format(describe(bCodes, B_CODES)))
+    out.write('Instructions executed: {}/{} words in {} programs\n'.format(executedWords, totalWords, len(images)))
+    out.write('Conditional branches taking both directions: {}/{}\n'.format(bothDirections, branches))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        sys.stderr.write('Usage: python test/mips_coverage.py <merged-output.cov> <input.cov>...\n')
+        sys.exit(1)
+    merged = merge(sys.argv[2:])
+    write(sys.argv[1], merged)
+    summarise(merged, sys.stdout)
@@ -1,15 +1,68 @@
 from subprocess import Popen, PIPE
 from threading import Timer
+import base64
+import hashlib
+import json
 import os
 import sys
 
 TEST_TIMEOUT = 5
 
-# Compile assembly test files into binary
+# Results of earlier runs, keyed by a hash of the simulator, the test binary and its input
+RESULT_CACHE_FILE = 'test/result_cache.json'
+
+# With --coverage, each simulator run records coverage and the results are merged into test/coverage.cov
+coverage = '--coverage' in sys.argv[2:]
+coverageFiles = []
+if coverage:
+    os.system('mkdir -p test/coverage')
+
+# With --no-cache, every test is run even if an identical run has been recorded
+useCache = '--no-cache' not in sys.argv[2:] and not coverage
+
+
+def isStale(target, source):
+    return not os.path.isfile(target) or os.path.getmtime(target) < os.path.getmtime(source)
+
+
+# Compile test files whose binary is missing or older than the source, in a single make invocation
 os.system('mkdir -p test/bin')
-for test in os.listdir('test/src'):
-    testName = test[:-2]
-    os.system('make test/bin/{}.mips.bin > /dev/null'.format(testName))
+staleBinaries = []
+for test in sorted(os.listdir('test/src')):
+    binary = 'test/bin/{}.mips.bin'.format(test[:-2])
+    if isStale(binary, 'test/src/' + test):
+        staleBinaries.append(binary)
+if staleBinaries:
+    os.system('make {} > /dev/null'.format(' '.join(staleBinaries)))
+
+
+def hashFile(path, digest):
+    with open(path, 'rb') as f:
+        digest.update(f.read())
+
+
+def resultKey(binary, inputPath):
+    # The simulator's own hash is computed once; a missing input file hashes differently from an empty one
+    digest = hashlib.sha256(simulatorHash.encode('ascii'))
+    hashFile(binary, digest)
+    if inputPath is not None:
+        digest.update(b'input')
+        hashFile(inputPath, digest)
+    return digest.hexdigest()
+
+
+resultCache = {}
+usedResults = {}
+if useCache:
+    simulatorDigest = hashlib.sha256()
+    hashFile(sys.argv[1], simulatorDigest)
+    simulatorHash = simulatorDigest.hexdigest()
+    if os.path.isfile(RESULT_CACHE_FILE):
+        try:
+            with open(RESULT_CACHE_FILE) as f:
+                resultCache = json.load(f)
+        except ValueError:
+            resultCache = {}
 
 count = 0
 passCount = 0
@@ -18,18 +71,39 @@ for test in sorted(os.listdir('test/bin')):
     testName = test[:-9]
 
     input = PIPE
+    inputPath = None
     # Check if input files exist
     if os.path.isfile('test/input/{}.in'.format(testName)):
-        input = open('test/input/{}.in'.format(testName))
+        inputPath = 'test/input/{}.in'.format(testName)
+        input = open(inputPath)
+
+    key = resultKey('test/bin/' + test, inputPath) if useCache else None
+    if key in resultCache:
+        cached = resultCache[key]
+        output = base64.b64decode(cached['output'])
+        err = base64.b64decode(cached['err'])
+        exitCode = cached['exitCode']
+    else:
+        command = [sys.argv[1], 'test/bin/' + test]
+        if coverage:
+            coverageFile = 'test/coverage/{}.cov'.format(testName)
+            command += ['--coverage', coverageFile]
+            coverageFiles.append(coverageFile)
+
+        p = Popen(command, stdout=PIPE, stderr=PIPE, stdin=input)
 
-    p = Popen([sys.argv[1], 'test/bin/' + test], stdout=PIPE, stderr=PIPE, stdin=input)
+        # Kill simulator if test takes longer than TEST_TIMEOUT seconds
+        timer = Timer(TEST_TIMEOUT, p.kill)
+        timer.start()
 
-    # Kill simulator if test takes longer than TEST_TIMEOUT seconds
-    timer = Timer(TEST_TIMEOUT, p.kill)
-    timer.start()
+        output, err = p.communicate()
+        exitCode = int(p.returncode)
+        timer.cancel()
 
-    output, err = p.communicate()
-    exitCode = int(p.returncode)
+    # A run killed by the timeout may just have been slow, so it is not recorded
+    if useCache and exitCode >= 0:
+        usedResults[key] = {'exitCode': exitCode, 'output': base64.b64encode(output).decode('ascii'),
+                            'err': base64.b64encode(err).decode('ascii')}
 
     # Output any errors received
     if err:
@@ -63,7 +137,18 @@ for test in sorted(os.listdir('test/bin')):
         # Print error message with red text
         sys.stderr.write('ERROR FROM {}: Exit code was {} and expected {}; Output was "{}" and expected "{}"\n'.format(testName, exitCode, expectedExitCode, output, expectedOut))
 
-    timer.cancel()
     count += 1
 
+# Only keep results for the current simulator and tests, so the cache does not grow without bound
+if useCache:
+    with open(RESULT_CACHE_FILE, 'w') as f:
+        json.dump(usedResults, f)
+
 sys.stderr.write('Test cases passed: {}/{} -- {}%\n'.format(passCount, count, 100 * passCount / count))
+
+if coverage:
+    import mips_coverage
+    # Runs killed by the timeout do not write their coverage
+    merged = mips_coverage.merge([f for f in coverageFiles if os.path.isfile(f)])
+    mips_coverage.write('test/coverage.cov', merged)
+    mips_coverage.summarise(merged, sys.stderr)
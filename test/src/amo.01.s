@@ -0,0 +1,19 @@
+# agent
+# Atomic swap of 9 into a word holding 7 returns 7 and leaves 9
+    .globl entry
+
+entry:
+    li $t0, 0x30000000
+    li $t1, 0x20000000
+    li $t2, 7
+    sw $t2, 0($t1)
+    sw $t1, 16($t0)
+    li $t2, 9
+    sw $t2, 20($t0)
+    lw $t3, 24($t0)
+    lw $t4, 0($t1)
+    li $t5, 10
+    mult $t3, $t5
+    mflo $t3
+    addu $v0, $t3, $t4
+    jr $zero
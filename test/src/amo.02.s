@@ -0,0 +1,16 @@
+# agent
+# Atomic add of 2 to a word holding 40 returns 40 and leaves 42
+    .globl entry
+
+entry:
+    li $t0, 0x30000000
+    li $t1, 0x20000000
+    li $t2, 40
+    sw $t2, 0($t1)
+    sw $t1, 16($t0)
+    li $t2, 2
+    sw $t2, 20($t0)
+    lw $t3, 28($t0)
+    lw $t4, 0($t1)
+    addu $v0, $t3, $t4
+    jr $zero
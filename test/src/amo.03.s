@@ -0,0 +1,10 @@
+# agent
+# Atomic add on an address outside data memory causes an exception
+    .globl entry
+
+entry:
+    li $t0, 0x30000000
+    li $t1, 0x10000000
+    sw $t1, 16($t0)
+    lw $v0, 28($t0)
+    jr $zero
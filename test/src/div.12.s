@@ -0,0 +1,11 @@
+# agent
+# DIV of INT32_MIN by -1 checking quotient wraps to INT32_MIN instead of trapping
+    .globl entry
+
+entry:
+    li $t0, 0x80000000
+    li $t1, -1
+    div $t0, $t1
+    mflo $v0
+    srl $v0, $v0, 24
+    jr $zero
@@ -0,0 +1,13 @@
+# agent
+# DIV of INT32_MIN by -1 checking remainder is 0
+    .globl entry
+
+entry:
+    li $t0, 0x80000000
+    li $t1, -1
+    li $t2, 99
+    mthi $t2
+    div $t0, $t1
+    mfhi $v0
+    addiu $v0, $v0, 5
+    jr $zero
@@ -0,0 +1,26 @@
+# agent
+# A byte fill loop sets every byte in its range and no others
+    .globl entry
+
+entry:
+    li $t0, 0x20000001
+    li $t1, 0x2000012D
+    li $t2, 7
+
+fill:
+    sb $t2, 0($t0)
+    addiu $t0, $t0, 1
+    bne $t0, $t1, fill
+
+    li $t3, 0x20000000
+    lbu $t4, 0($t3)
+    lbu $t5, 1($t3)
+    lbu $t6, 300($t3)
+    lbu $t7, 301($t3)
+    addu $v0, $t4, $t5
+    addu $v0, $v0, $t6
+    addu $v0, $v0, $t7
+    subu $t0, $t0, $t3
+    addiu $t0, $t0, -200
+    addu $v0, $v0, $t0
+    jr $zero
@@ -0,0 +1,37 @@
+# agent
+# A word copy loop copies every word and leaves the last one copied in its register
+    .globl entry
+
+entry:
+    li $t0, 0x20000100
+    li $t1, 0
+    li $t2, 150
+
+source:
+    sw $t1, 0($t0)
+    addiu $t1, $t1, 3
+    addiu $t0, $t0, 4
+    bne $t1, $t2, source
+
+    li $t0, 0x20000100
+    li $t3, 0x20000400
+    li $t4, 0x200001C8
+
+copy:
+    lw $t5, 0($t0)
+    sw $t5, 0($t3)
+    addiu $t0, $t0, 4
+    addiu $t3, $t3, 4
+    bne $t0, $t4, copy
+
+    li $t6, 0x20000400
+    lw $t7, 196($t6)
+    lw $t8, 200($t6)
+    subu $t3, $t3, $t6
+    srl $t3, $t3, 2
+    addiu $v0, $t5, -100
+    addu $v0, $v0, $t3
+    addu $v0, $v0, $t7
+    addu $v0, $v0, $t8
+    addiu $v0, $v0, -147
+    jr $zero
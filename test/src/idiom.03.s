@@ -0,0 +1,29 @@
+# agent
+# A strlen loop over a string read from input stops at the terminating zero
+    .globl entry
+
+entry:
+    li $t0, 0x20000000
+    li $t1, 0x30000000
+    li $t2, -1
+
+read:
+    lw $t3, 0($t1)
+    beq $t3, $t2, terminate
+    sb $t3, 0($t0)
+    addiu $t0, $t0, 1
+    j read
+
+terminate:
+    sb $zero, 0($t0)
+    li $t0, 0x20000000
+
+length:
+    lb $t4, 0($t0)
+    addiu $t0, $t0, 1
+    bne $t4, $zero, length
+
+    li $t5, 0x20000001
+    subu $v0, $t0, $t5
+    addu $v0, $v0, $t4
+    jr $zero
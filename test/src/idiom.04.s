@@ -0,0 +1,21 @@
+# agent
+# A scan loop that clears each byte after loading it stops at the original terminator
+    .globl entry
+
+entry:
+    li $a0, 0x20000000
+    li $t2, 10
+    sb $t2, 5($a0)
+
+scan:
+    lb $t1, 0($a0)
+    sb $zero, 0($a0)
+    addiu $a0, $a0, 1
+    bne $t1, $t2, scan
+
+    li $t3, 0x20000000
+    lbu $t4, 5($t3)
+    subu $a0, $a0, $t3
+    addu $v0, $t1, $a0
+    addu $v0, $v0, $t4
+    jr $zero
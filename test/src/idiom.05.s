@@ -0,0 +1,27 @@
+# agent
+# A counted word loop that clears each word after loading it leaves the last word loaded in its register
+    .globl entry
+
+entry:
+    li $a0, 0x20000100
+    li $a1, 0x20000140
+    li $t0, 40
+
+source:
+    sw $t0, 0($a0)
+    addiu $t0, $t0, 1
+    addiu $a0, $a0, 4
+    bne $a0, $a1, source
+
+    li $a0, 0x20000100
+
+clear:
+    lw $t1, 0($a0)
+    sw $zero, 0($a0)
+    addiu $a0, $a0, 4
+    bne $a0, $a1, clear
+
+    li $t3, 0x20000100
+    lw $t4, 60($t3)
+    addu $v0, $t1, $t4
+    jr $zero
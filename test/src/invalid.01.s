@@ -0,0 +1,8 @@
+# agent
+# Unassigned opcode 0x13 exits with an invalid instruction error
+    .globl entry
+
+entry:
+    li $v0, 5
+    .word 0x4c000000
+    jr $zero
@@ -0,0 +1,8 @@
+# agent
+# Unassigned function code 0x3F exits with an invalid instruction error
+    .globl entry
+
+entry:
+    li $v0, 5
+    .word 0x0000003f
+    jr $zero
@@ -0,0 +1,8 @@
+# agent
+# Unassigned REGIMM code 0x02 exits with an invalid instruction error
+    .globl entry
+
+entry:
+    li $v0, 5
+    .word 0x04020000
+    jr $zero